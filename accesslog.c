@@ -0,0 +1,229 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    accesslog.c: Asynchronous access log
+
+    Request handlers never write the log themselves. Each thread appends
+    records to its own ring, single producer single consumer, and a writer
+    thread drains all of them every ACCESSLOG_FLUSH_MS and writes the lines
+    in one go. A full ring drops the record and counts it, handlers never
+    wait on the log.
+
+*/
+
+#include "accesslog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "config.h"
+
+typedef struct {
+    time_t time;
+    int status;
+    double latency;             /* seconds */
+    long results;               /* -1 for none */
+    size_t bytes;
+    char addr[48];
+    char method[8];
+    char url[ACCESSLOG_URL_SIZE];
+    char note[64];
+} record_t;
+
+typedef struct ring_s {
+    atomic_size_t head;         /* next to write out, writer owned */
+    atomic_size_t tail;         /* next free, handler owned */
+    atomic_ulong dropped;
+    struct ring_s *next;
+    record_t records[ACCESSLOG_RING_SIZE];
+} ring_t;
+
+/* rings are pushed once per thread and never removed */
+static _Atomic(ring_t *) rings = NULL;
+static __thread ring_t *ring = NULL;
+
+static atomic_ulong written, dropped;
+
+static ring_t *
+ring_get(void)
+{
+    if (ring)
+        return ring;
+
+    ring = calloc(1, sizeof(ring_t));
+    if (!ring)
+        return NULL;
+
+    ring_t *head = atomic_load(&rings);
+    do
+        ring->next = head;
+    while (!atomic_compare_exchange_weak(&rings, &head, ring));
+
+    return ring;
+}
+
+static void
+copy(char *dst, const char *src, size_t size)
+{
+    size_t len = src ? strnlen(src, size - 1) : 0;
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+void
+accesslog_add(const char *addr, const char *method, const char *url,
+    int status, double latency, long results, size_t bytes, const char *note)
+{
+    ring_t *r = ring_get();
+    if (!r) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail - head == ACCESSLOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    record_t *rec = &r->records[tail % ACCESSLOG_RING_SIZE];
+    rec->time = time(NULL);
+    rec->status = status;
+    rec->latency = latency;
+    rec->results = results;
+    rec->bytes = bytes;
+    copy(rec->addr, addr, sizeof(rec->addr));
+    copy(rec->method, method, sizeof(rec->method));
+    copy(rec->url, url, sizeof(rec->url));
+    copy(rec->note, note, sizeof(rec->note));
+
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/* formatted once per second, records of the same second share it */
+static const char *
+timestr(time_t t)
+{
+    static time_t cached = -1;
+    static char buff[32];
+
+    if (t != cached) {
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        strftime(buff, sizeof(buff), "%Y-%m-%d %H:%M:%S", &tm);
+        cached = t;
+    }
+    return buff;
+}
+
+static size_t
+format(char *buff, size_t size, const record_t *rec)
+{
+    int len = snprintf(buff, size, "[%s] [webserver] %s %s %s: %d %.3f ms",
+        timestr(rec->time), rec->addr, rec->method, rec->url, rec->status,
+        rec->latency * 1000.0);
+    if (rec->results >= 0 && len < size)
+        len += snprintf(buff + len, size - len, " %ld results", rec->results);
+    if (len < size)
+        len += snprintf(buff + len, size - len, " %lu B%s%s\n", rec->bytes,
+            *rec->note ? " " : "", rec->note);
+    return len < size ? len : size - 1;
+}
+
+static void *
+accesslog_writer(void *arg)
+{
+    static char buff[ACCESSLOG_BUFF_SIZE];
+    struct timespec interval = {
+        ACCESSLOG_FLUSH_MS / 1000, (ACCESSLOG_FLUSH_MS % 1000) * 1000000L
+    };
+
+    for (;;) {
+        size_t len = 0, lines = 0;
+        unsigned long lost = 0;
+
+        for (ring_t *r = atomic_load(&rings); r; r = r->next) {
+            size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+            size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+            for (; head != tail; head++) {
+                /* longest line fits, write out before it could not */
+                if (ACCESSLOG_BUFF_SIZE - len < 2 * ACCESSLOG_URL_SIZE) {
+                    fwrite(buff, 1, len, stdout);
+                    len = 0;
+                }
+                len += format(buff + len, ACCESSLOG_BUFF_SIZE - len,
+                    &r->records[head % ACCESSLOG_RING_SIZE]);
+                lines++;
+            }
+            atomic_store_explicit(&r->head, head, memory_order_release);
+
+            lost += atomic_exchange_explicit(&r->dropped, 0,
+                memory_order_relaxed);
+        }
+
+        if (lost) {
+            len += snprintf(buff + len, ACCESSLOG_BUFF_SIZE - len,
+                "[%s] [webserver] %lu access log records dropped\n",
+                timestr(time(NULL)), lost);
+            atomic_fetch_add(&dropped, lost);
+        }
+
+        if (len) {
+            fwrite(buff, 1, len, stdout);
+            fflush(stdout);
+        }
+        atomic_fetch_add(&written, lines);
+
+        /* a burst, go again before the rings fill up */
+        if (lines < ACCESSLOG_RING_SIZE / 2)
+            nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+int
+accesslog_start(void)
+{
+    pthread_t thread;
+    int err = pthread_create(&thread, NULL, accesslog_writer, NULL);
+    if (err) {
+        fprintf(stderr, "[accesslog] pthread_create(): %s\n", strerror(err));
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+size_t
+accesslog_stats(char *buff, size_t size)
+{
+    size_t len = snprintf(buff, size,
+        "access log\n"
+        "\twritten: %lu\n"
+        "\tdropped: %lu\n",
+        atomic_load(&written), atomic_load(&dropped));
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,33 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    accesslog.c: Asynchronous access log
+
+*/
+
+#ifndef _ACCESSLOG_H
+#define _ACCESSLOG_H
+
+#include <stddef.h>
+
+int accesslog_start(void);
+void accesslog_add(const char *addr, const char *method, const char *url,
+    int status, double latency, long results, size_t bytes, const char *note);
+size_t accesslog_stats(char *buff, size_t size);
+
+#endif /* _ACCESSLOG_H */
@@ -0,0 +1,184 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    acm.c: Aho-Corasick multi-pattern substring matcher
+
+    Patterns are compiled into a trie over a compact alphabet of the bytes
+    they use, every other byte leads back to the root. The root row is dense,
+    the other goto edges live in one open addressing table and misses follow
+    failure links, so memory is linear in the total pattern length. Case
+    folding is done by the alphabet map, so a case insensitive scan costs the
+    same.
+
+*/
+
+#include "acm.h"
+
+#include <string.h>
+#include <ctype.h>
+
+static inline size_t
+acm_hash(int32_t state, size_t sym, size_t mask)
+{
+    return ((uint32_t)state * 2654435761u ^ sym) & mask;
+}
+
+/* state reached from state over sym, -1 without such edge */
+static inline int32_t
+acm_goto(const acm_t *acm, int32_t state, size_t sym)
+{
+    if (!state)
+        return acm->root[sym];
+
+    for (size_t i = acm_hash(state, sym, acm->mask); acm->edges[i].state;
+        i = (i + 1) & acm->mask)
+    {
+        if (acm->edges[i].state == state && acm->edges[i].sym == sym)
+            return acm->edges[i].next;
+    }
+    return -1;
+}
+
+acm_t *
+acm_new(const char **patterns, size_t n, int nocase, arena_t *arena)
+{
+    acm_t *acm = arena_calloc(arena, sizeof(acm_t));
+
+    /* alphabet, symbol 0 is reserved for bytes no pattern has */
+    size_t total = 1, maxlen = 0;
+    for (size_t p = 0; p < n; p++) {
+        size_t len = 0;
+        for (const unsigned char *c = (const unsigned char*)patterns[p]; *c;
+            c++, len++)
+        {
+            unsigned char b = nocase ? tolower(*c) : *c;
+            if (!acm->map[b])
+                acm->map[b] = ++acm->nsym;
+        }
+        total += len;
+        if (len > maxlen)
+            maxlen = len;
+    }
+    acm->nsym++;
+
+    if (nocase)
+        for (int b = 0; b < 256; b++)
+            acm->map[b] = acm->map[tolower(b)];
+
+    /* at most one state per pattern byte, plus the root, edge table kept
+     * at most half full */
+    size_t slots = 16;
+    while (slots < 2 * total)
+        slots <<= 1;
+    acm->mask = slots - 1;
+
+    acm->root = arena_calloc(arena, sizeof(int32_t) * acm->nsym);
+    acm->edges = arena_calloc(arena, sizeof(acm_edge_t) * slots);
+    acm->fail = arena_calloc(arena, sizeof(int32_t) * total);
+    acm->out = arena_calloc(arena, sizeof(int32_t) * total);
+    acm->first = arena_alloc(arena, sizeof(int32_t) * total);
+    acm->same = arena_alloc(arena, sizeof(int32_t) * (n ? n : 1));
+    memset(acm->first, 0xff, sizeof(int32_t) * total);
+    acm->nstates = 1;
+
+    /* parent, symbol and depth of each state, to set failure links in
+     * breadth first order */
+    int32_t *parent = arena_alloc(arena, sizeof(int32_t) * total);
+    uint16_t *symbol = arena_alloc(arena, sizeof(uint16_t) * total);
+    uint32_t *depth = arena_alloc(arena, sizeof(uint32_t) * total);
+    depth[0] = 0;
+
+    /* trie */
+    for (size_t p = 0; p < n; p++) {
+        int32_t s = 0;
+        for (const unsigned char *c = (const unsigned char*)patterns[p]; *c;
+            c++)
+        {
+            size_t sym = acm->map[*c];
+            int32_t t = acm_goto(acm, s, sym);
+            if (t <= 0) {
+                t = acm->nstates++;
+                parent[t] = s;
+                symbol[t] = sym;
+                depth[t] = depth[s] + 1;
+
+                if (!s)
+                    acm->root[sym] = t;
+                else {
+                    size_t i = acm_hash(s, sym, acm->mask);
+                    while (acm->edges[i].state)
+                        i = (i + 1) & acm->mask;
+                    acm->edges[i] = (acm_edge_t){ s, t, sym };
+                }
+            }
+            s = t;
+        }
+        acm->same[p] = acm->first[s];
+        acm->first[s] = p;
+    }
+
+    /* counting sort by depth */
+    size_t *count = arena_calloc(arena, sizeof(size_t) * (maxlen + 2));
+    int32_t *order = arena_alloc(arena, sizeof(int32_t) * acm->nstates);
+    for (size_t s = 1; s < acm->nstates; s++)
+        count[depth[s] + 1]++;
+    for (size_t d = 1; d <= maxlen + 1; d++)
+        count[d] += count[d - 1];
+    for (size_t s = 1; s < acm->nstates; s++)
+        order[count[depth[s]]++] = s;
+
+    /* failure links, the root never misses */
+    for (size_t i = 0; i + 1 < acm->nstates; i++) {
+        int32_t t = order[i];
+        if (!parent[t])
+            continue;
+
+        int32_t f = acm->fail[parent[t]], g;
+        while ((g = acm_goto(acm, f, symbol[t])) < 0)
+            f = acm->fail[f];
+        acm->fail[t] = g;
+        acm->out[t] = acm->first[g] >= 0 ? g : acm->out[g];
+    }
+
+    return acm;
+}
+
+void
+acm_run(const acm_t *acm, const char *s, acm_fn_t fn, void *arg)
+{
+    int32_t state = 0;
+    for (const unsigned char *c = (const unsigned char*)s; *c; c++) {
+        size_t sym = acm->map[*c];
+        if (!sym) {
+            state = 0;
+            continue;
+        }
+
+        int32_t next;
+        while ((next = acm_goto(acm, state, sym)) < 0)
+            state = acm->fail[state];
+        state = next;
+        if (!state)
+            continue;
+
+        int32_t t = acm->first[state] >= 0 ? state : acm->out[state];
+        for (; t; t = acm->out[t])
+            for (int32_t p = acm->first[t]; p >= 0; p = acm->same[p])
+                fn(p, arg);
+    }
+}
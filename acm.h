@@ -0,0 +1,57 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    acm.c: Aho-Corasick multi-pattern substring matcher
+
+*/
+
+#ifndef _ACM_H
+#define _ACM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+typedef struct {
+    int32_t state;              /* 0 for a free slot, the root is dense */
+    int32_t next;
+    uint16_t sym;
+} acm_edge_t;
+
+typedef struct {
+    unsigned char map[256];     /* byte to symbol, 0 for bytes in no pattern */
+    size_t nsym;
+    int32_t *root;              /* symbol to state, 0 stays at the root */
+    acm_edge_t *edges;          /* goto edges of other states, open hash */
+    size_t mask;
+    int32_t *fail;
+    int32_t *out;               /* nearest matching proper suffix state, 0 */
+    int32_t *first;             /* first pattern ending in state, -1 */
+    int32_t *same;              /* pattern to next one with the same text */
+    size_t nstates;
+} acm_t;
+
+/* called once per pattern occurrence */
+typedef void (*acm_fn_t)(size_t pattern, void *arg);
+
+acm_t *acm_new(const char **patterns, size_t n, int nocase, arena_t *arena);
+void acm_run(const acm_t *acm, const char *s, acm_fn_t fn, void *arg);
+
+#endif /* _ACM_H */
+
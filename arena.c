@@ -0,0 +1,172 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    arena.c: Per request bump allocator
+
+    Allocation is a pointer bump, teardown a single reset. Arenas keep their
+    blocks across requests and are recycled through a small per thread pool.
+
+*/
+
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#define ARENA_ALIGN     16
+
+struct arena_block_s {
+    struct arena_block_s *next;
+    size_t size, used;
+    char data[];
+};
+
+static __thread arena_t *pool = NULL;
+static __thread size_t pool_size = 0;
+
+
+static size_t
+align(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+arena_t *
+arena_get(void)
+{
+    arena_t *arena = pool;
+    if (arena) {
+        pool = arena->next;
+        pool_size--;
+        arena->next = NULL;
+        return arena;
+    }
+
+    arena = malloc(sizeof(arena_t));
+    memset(arena, 0, sizeof(arena_t));
+    return arena;
+}
+
+void
+arena_put(arena_t *arena)
+{
+    arena_reset(arena);
+
+    if (pool_size >= ARENA_POOL_MAX) {
+        for (struct arena_block_s *block = arena->blocks; block; ) {
+            struct arena_block_s *next = block->next;
+            free(block);
+            block = next;
+        }
+        free(arena);
+        return;
+    }
+
+    arena->next = pool;
+    pool = arena;
+    pool_size++;
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+    size = align(size);
+    arena->allocs++;
+
+    struct arena_block_s *block = arena->blocks;
+    if (!block || block->used + size > block->size) {
+        /* a block emptied by the last reset, else a new one */
+        struct arena_block_s **link = &arena->blocks;
+        while (*link && ((*link)->used || (*link)->size < size))
+            link = &(*link)->next;
+
+        if (*link) {
+            block = *link;
+            *link = block->next;
+        } else {
+            size_t bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+            block = malloc(sizeof(struct arena_block_s) + bsize);
+            block->size = bsize;
+            block->used = 0;
+            arena->mallocs++;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void *
+arena_calloc(arena_t *arena, size_t size)
+{
+    void *ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/* grows in place when ptr is the last allocation and the block has room */
+void *
+arena_realloc(arena_t *arena, void *ptr, size_t old, size_t size)
+{
+    if (!ptr)
+        return arena_alloc(arena, size);
+
+    struct arena_block_s *block = arena->blocks;
+    if (ptr == arena->last &&
+        (size_t)((char*)ptr - block->data) + align(size) <= block->size)
+    {
+        arena->allocs++;
+        block->used = (char*)ptr - block->data + align(size);
+        return ptr;
+    }
+
+    void *new = arena_alloc(arena, size);
+    memcpy(new, ptr, old < size ? old : size);
+    return new;
+}
+
+void
+arena_reset(arena_t *arena)
+{
+    size_t kept = 0;
+    struct arena_block_s **link = &arena->blocks;
+
+    /* keep a bounded amount of memory for the next request */
+    while (*link) {
+        struct arena_block_s *block = *link;
+        if (kept + block->size > ARENA_RETAIN) {
+            *link = block->next;
+            free(block);
+            continue;
+        }
+        kept += block->size;
+        block->used = 0;
+        link = &block->next;
+    }
+
+    arena->last = NULL;
+    arena->allocs = 0;
+    arena->mallocs = 0;
+}
+
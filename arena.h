@@ -0,0 +1,43 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    arena.c: Per request bump allocator
+
+*/
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_s {
+    struct arena_block_s *blocks;   /* current block first */
+    void *last;                     /* last allocation, grows in place */
+    unsigned long allocs, mallocs;  /* since the last reset */
+    struct arena_s *next;           /* pool */
+} arena_t;
+
+arena_t *arena_get(void);
+void arena_put(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_calloc(arena_t *arena, size_t size);
+void *arena_realloc(arena_t *arena, void *ptr, size_t old, size_t size);
+void arena_reset(arena_t *arena);
+
+#endif /* _ARENA_H */
+
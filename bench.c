@@ -0,0 +1,317 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    bench.c: Benchmarks and self checks over a directory tree
+
+    Usage: bench <dir> [query]. Every section prints its numbers and checks
+    what it measured, the exit status is 1 if any check failed.
+
+*/
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#include "config.h"
+#include "arena.h"
+#include "crawl.h"
+#include "dict.h"
+#include "index.h"
+
+#define BENCH_RUNS  20
+
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 0.000000001 * ts.tv_nsec;
+}
+
+/* pooled arenas against the heap, for one lookup per request */
+static int
+bench_arena(index_t index, const char *query)
+{
+    int ret = 0;
+
+    /* a put arena comes back warm, without new blocks */
+    arena_t *arena = arena_get();
+    arena_alloc(arena, 1000);
+    arena_put(arena);
+    arena_t *again = arena_get();
+    arena_alloc(again, 1000);
+    if (again != arena || again->mallocs != 0) {
+        fprintf(stderr, "[bench] arena: pool did not reuse a warm arena\n");
+        ret = -1;
+    }
+    arena_put(again);
+
+    size_t nresults = 0;
+    double start = now();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        results_t *results = index_lookup(index, LOOKUP_SUBSTR, query, NULL,
+            NULL, NULL, NULL);
+        nresults = results->size;
+        results_destroy(results);
+    }
+    double heap = (now() - start) / BENCH_RUNS;
+
+    unsigned long allocs = 0, mallocs = 0;
+    start = now();
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        arena = arena_get();
+        results_t *results = index_lookup(index, LOOKUP_SUBSTR, query, NULL,
+            NULL, arena, NULL);
+        if (results->size != nresults) {
+            fprintf(stderr, "[bench] arena: %ld results, %ld on the heap\n",
+                results->size, nresults);
+            ret = -1;
+        }
+        results_destroy(results);
+        allocs += arena->allocs;
+        mallocs += arena->mallocs;
+        arena_put(arena);
+    }
+    double pooled = (now() - start) / BENCH_RUNS;
+
+    printf("arena: \"%s\" %ld results, heap %.3f ms, arena %.3f ms, "
+        "%.1f allocs %.1f mallocs per request\n", query, nresults,
+        heap * 1000, pooled * 1000, (double)allocs / BENCH_RUNS,
+        (double)mallocs / BENCH_RUNS);
+    return ret;
+}
+
+/* entries below dir, and an order independent sum of their metadata */
+static size_t
+bench_walk(crawl_t *crawl, const char *dir, unsigned long long *sum)
+{
+    crawl_listing_t listing;
+    if (crawl_dir(crawl, dir, &listing) < 0)
+        return 0;
+
+    size_t n = listing.size;
+    char path[4096];
+    for (size_t i = 0; i < listing.size; i++) {
+        const crawl_entry_t *de = &listing.entries[i];
+        *sum += (de->stat.st_ino * 0x9e3779b97f4a7c15ULL) ^
+            ((unsigned long long)de->stat.st_size << 1) ^
+            ((unsigned long long)de->stat.st_mtime << 17) ^
+            de->stat.st_mode ^ de->error;
+
+        if (!de->error && S_ISDIR(de->stat.st_mode) && de->type != DT_LNK) {
+            snprintf(path, sizeof(path), "%s/%s", dir, de->name);
+            n += bench_walk(crawl, path, sum);
+        }
+    }
+
+    crawl_listing_free(&listing);
+    return n;
+}
+
+/* fstatat() against io_uring statx, and the fallback when a ring cannot be
+ * set up, all of which must see the same metadata */
+static int
+bench_crawl(const char *dir)
+{
+    struct {
+        const char *what;
+        unsigned int depth;
+    } runs[] = {
+        { "fstatat", 0 },
+        { "io_uring", 64 },
+        { "fallback", 1 << 20 },    /* past the kernel limit, setup fails */
+    };
+    size_t nruns = sizeof(runs) / sizeof(runs[0]);
+
+    /* warm the caches, every run then reads the same */
+    crawl_opts_t opts = { 0 };
+    crawl_t *crawl = crawl_new(&opts);
+    unsigned long long want = 0;
+    size_t nwant = bench_walk(crawl, dir, &want);
+    crawl_destroy(crawl);
+
+    int ret = 0;
+    for (size_t i = 0; i < nruns; i++) {
+        opts.depth = runs[i].depth;
+        crawl = crawl_new(&opts);
+        const char *backend = crawl_backend(crawl);
+
+        unsigned long long sum = 0;
+        double start = now();
+        size_t n = bench_walk(crawl, dir, &sum);
+        double elapsed = now() - start;
+        crawl_destroy(crawl);
+
+        printf("crawl: %-8s %-14s %ld entries in %.3f s, %.0f entries/s\n",
+            runs[i].what, backend, n, elapsed,
+            elapsed > 0 ? n / elapsed : 0.0);
+
+        if (n != nwant || sum != want) {
+            fprintf(stderr, "[bench] crawl: %s saw other metadata\n",
+                runs[i].what);
+            ret = -1;
+        }
+        if (opts.depth == 1 << 20 && strcmp(backend, "fstatat") != 0) {
+            fprintf(stderr, "[bench] crawl: no fallback to fstatat()\n");
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+static int
+name_cmp(const void *p1, const void *p2)
+{
+    return strcmp(*(const char**)p1, *(const char**)p2);
+}
+
+/* glibc chunk of a strdup()'d string */
+static size_t
+strdup_size(const char *s)
+{
+    size_t size = (strlen(s) + 1 + sizeof(size_t) + 15) & ~(size_t)15;
+    return size < 32 ? 32 : size;
+}
+
+/* the names of the index, plus some past the one byte varint and NAME_MAX,
+ * front coded and decoded back */
+static int
+bench_dict(index_t index, const char *query)
+{
+    results_t *all = index_lookup(index, LOOKUP_SUBSTR, "", NULL, NULL, NULL,
+        NULL);
+    size_t n = all->size, nlong = 5;
+    const char **names = malloc(sizeof(char*) * (n + nlong));
+    size_t strdup_bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        names[i] = all->results[i]->name;
+        strdup_bytes += strdup_size(names[i]);
+    }
+
+    size_t lens[] = { 127, 128, 255, 256, 4000 };
+    char *longs[5];
+    for (size_t i = 0; i < nlong; i++) {
+        longs[i] = malloc(lens[i] + 1);
+        memset(longs[i], 'a' + i, lens[i]);
+        longs[i][lens[i]] = '\0';
+        names[n + i] = longs[i];
+    }
+
+    size_t ndistinct = 0;
+    qsort(names, n + nlong, sizeof(char*), name_cmp);
+    for (size_t i = 0; i < n + nlong; i++)
+        if (i == 0 || strcmp(names[i], names[ndistinct - 1]) != 0)
+            names[ndistinct++] = names[i];
+
+    int ret = 0;
+    dict_t *dict = dict_new(names, ndistinct);
+    dict_iter_t iter;
+    dict_iter_init(&iter, dict);
+    size_t decoded = 0;
+    for (const char *name; (name = dict_next(&iter)); decoded++) {
+        if (decoded >= ndistinct || iter.id != decoded ||
+            strcmp(name, names[decoded]) != 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    dict_iter_free(&iter);
+    if (decoded != ndistinct)
+        ret = -1;
+
+    /* every name, and one that is most likely not there */
+    char buff[64];
+    const char *miss = buff;
+    for (size_t i = 0; i < ndistinct && ret == 0; i++) {
+        snprintf(buff, sizeof(buff), "%.60s~", names[i]);
+        const char **found = bsearch(&miss, names, ndistinct, sizeof(char*),
+            name_cmp);
+        if (dict_find(dict, names[i]) != (long)i ||
+            dict_find(dict, miss) != (found ? found - names : -1))
+            ret = -1;
+    }
+    if (ret < 0)
+        fprintf(stderr, "[bench] dict: round trip failed\n");
+
+    /* a substring scan per node against one per distinct name */
+    size_t hits = 0, dict_hits = 0;
+    double start = now();
+    for (int r = 0; r < BENCH_RUNS; r++)
+        for (size_t i = 0; i < n; i++)
+            hits += strstr(all->results[i]->name, query) != NULL;
+    double nodes_time = (now() - start) / BENCH_RUNS;
+
+    start = now();
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        dict_iter_init(&iter, dict);
+        for (const char *name; (name = dict_next(&iter)); )
+            dict_hits += strstr(name, query) != NULL;
+        dict_iter_free(&iter);
+    }
+    double dict_time = (now() - start) / BENCH_RUNS;
+
+    printf("dict: %ld names, %ld distinct, %.1f bytes/name front coded, "
+        "%.1f bytes/name as strdup()\n", n, ndistinct,
+        n ? (double)dict->bytes / n : 0.0,
+        n ? (double)strdup_bytes / n : 0.0);
+    printf("dict: \"%s\" per node %.3f ms %.0f Mnames/s, per distinct name "
+        "%.3f ms, %ld and %ld matching\n", query, nodes_time * 1000,
+        nodes_time > 0 ? n / nodes_time / 1000000 : 0.0, dict_time * 1000,
+        hits / BENCH_RUNS, dict_hits / BENCH_RUNS);
+
+    for (size_t i = 0; i < nlong; i++)
+        free(longs[i]);
+    dict_destroy(dict);
+    free(names);
+    results_destroy(all);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <dir> [query]\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1], *query = argc > 2 ? argv[2] : "e";
+
+    if (index_init() < 0)
+        return 1;
+
+    crawl_opts_t opts = { 0 };
+    index_t index = index_new(INIT_MAP_CAPACITY, dir, strlen(dir) + 1, 0,
+        &opts);
+    if (!index) {
+        fprintf(stderr, "[bench] error indexing %s\n", dir);
+        return 1;
+    }
+
+    int ret = 0;
+    ret |= bench_arena(index, query);
+    ret |= bench_crawl(dir);
+    ret |= bench_dict(index, query);
+
+    index_unref(index);
+    return ret < 0 ? 1 : 0;
+}
@@ -28,9 +28,14 @@
 #include <errno.h>
 
 unsigned short port = 0;
-char *tmpl_path = NULL, *root = NULL, *app_subdir = NULL,
-    *result_subdir = NULL;
-int magic_enable = 0, period = 86400;
+char *tmpl_path = NULL, *app_subdir = NULL, *result_subdir = NULL;
+int magic_enable = 0, period = 86400, timeout = DEFAULT_TIMEOUT,
+    threads = DEFAULT_THREADS, uring_depth = 0;
+int crawl_idle = 0, crawl_rate = 0, crawl_dir_rate = 0, crawl_max_util = 0;
+double crawl_max_load = 0.0;
+char *crawl_disk = NULL;
+root_t *roots = NULL;
+size_t nroots = 0;
 
 int
 config_load(const char *conf_path)
@@ -72,9 +77,24 @@ config_load(const char *conf_path)
             printf("\ttemplate: %s\n", tmpl_path);
         }
         else if (strcmp(line, "root") == 0) {
+            /* root=<path>[,<period>], paths may contain commas so only
+             * an all digit suffix is a period */
             value[strlen(value) - 1] = '\0';
-            root = strdup(value);
-            printf("\troot: %s\n", root);
+            char *comma = strrchr(value, ',');
+            roots = realloc(roots, sizeof(root_t) * (nroots + 1));
+            roots[nroots].period = 0;
+            if (comma && comma[1] &&
+                strspn(comma + 1, "0123456789") == strlen(comma + 1))
+            {
+                *comma = '\0';
+                roots[nroots].period = atoi(comma + 1);
+            }
+            roots[nroots].path = strdup(value);
+            printf("\troot: %s", roots[nroots].path);
+            if (roots[nroots].period)
+                printf(" (period %d)", roots[nroots].period);
+            printf("\n");
+            nroots++;
         }
         else if (strcmp(line, "app_subdir") == 0) {
             value[strlen(value) - 1] = '\0';
@@ -96,6 +116,59 @@ config_load(const char *conf_path)
             period = atoi(value);
             printf("\tperiod: %d\n", period);
         }
+        else if (strcmp(line, "timeout") == 0) {
+            value[strlen(value) - 1] = '\0';
+            timeout = atoi(value);
+            printf("\ttimeout: %d\n", timeout);
+        }
+        else if (strcmp(line, "uring_depth") == 0) {
+            value[strlen(value) - 1] = '\0';
+            uring_depth = atoi(value);
+            printf("\turing_depth: %d\n", uring_depth);
+            if (uring_depth < 0) {
+                fprintf(stderr, "[config] invalid uring_depth: %s\n", value);
+                return -1;
+            }
+        }
+        else if (strcmp(line, "crawl_idle") == 0) {
+            value[strlen(value) - 1] = '\0';
+            crawl_idle = (strcmp(value, "true") == 0);
+            printf("\tcrawl_idle: %d\n", crawl_idle);
+        }
+        else if (strcmp(line, "crawl_rate") == 0) {
+            value[strlen(value) - 1] = '\0';
+            crawl_rate = atoi(value);
+            printf("\tcrawl_rate: %d\n", crawl_rate);
+        }
+        else if (strcmp(line, "crawl_dir_rate") == 0) {
+            value[strlen(value) - 1] = '\0';
+            crawl_dir_rate = atoi(value);
+            printf("\tcrawl_dir_rate: %d\n", crawl_dir_rate);
+        }
+        else if (strcmp(line, "crawl_max_load") == 0) {
+            value[strlen(value) - 1] = '\0';
+            crawl_max_load = atof(value);
+            printf("\tcrawl_max_load: %.2f\n", crawl_max_load);
+        }
+        else if (strcmp(line, "crawl_max_util") == 0) {
+            value[strlen(value) - 1] = '\0';
+            crawl_max_util = atoi(value);
+            printf("\tcrawl_max_util: %d\n", crawl_max_util);
+        }
+        else if (strcmp(line, "crawl_disk") == 0) {
+            value[strlen(value) - 1] = '\0';
+            crawl_disk = strdup(value);
+            printf("\tcrawl_disk: %s\n", crawl_disk);
+        }
+        else if (strcmp(line, "threads") == 0) {
+            value[strlen(value) - 1] = '\0';
+            threads = atoi(value);
+            printf("\tthreads: %d\n", threads);
+            if (threads <= 0) {
+                fprintf(stderr, "[config] invalid threads: %s\n", value);
+                return -1;
+            }
+        }
         else {
             fprintf(stderr, "[config] unknown key: %s\n", line);
             continue;
@@ -114,11 +187,18 @@ config_load(const char *conf_path)
         tmpl_path = DEFAULT_TMPL_PATH;
     }
 
-    if (!root) {
+    if (nroots == 0) {
         fprintf(stderr, "[config] E: no root given\n");
         return -1;
     }
 
+    for (size_t i = 0; i < nroots; i++)
+        if (roots[i].period <= 0)
+            roots[i].period = period;
+
+    if (crawl_max_util > 0 && !crawl_disk)
+        fprintf(stderr, "[config] W: crawl_max_util without crawl_disk\n");
+
     if (!app_subdir) {
         fprintf(stderr, "[config] E: no application subdirectory given\n");
         return -1;
@@ -21,18 +21,52 @@
 #ifndef _CONFIG_H
 #define _CONFIG_H
 
+#include <stddef.h>
+
 #define BUFF_SIZE           65535
 #define INIT_VEC_CAPACITY   256
+#define INIT_HITS_CAPACITY  16   /* first allocation of a bare hit list */
 #define INIT_MAP_CAPACITY   1024 /* index directory initial size */
+#define EXT_MAX_LEN         15   /* longer suffixes are not extensions */
+#define FACET_TOP           8    /* facet values shown per result page */
+#define ARENA_BLOCK_SIZE    65536
+#define ARENA_RETAIN        1048576 /* kept per arena between requests */
+#define ARENA_POOL_MAX      8    /* idle arenas kept per thread */
+#define DEADLINE_CHECK_NODES 1024 /* nodes scanned between deadline checks */
+#define DEADLINE_PROBE_MS   20   /* client hangup check interval */
+#define SHARD_WORKERS       2    /* lookup pool threads per extra shard */
+#define BATCH_MAX_SIZE      131072 /* batch request body limit */
+#define BATCH_MAX_PATTERNS  1024 /* patterns per batch request */
+#define BATCH_MAX_BYTES     65536 /* pattern bytes per batch request */
+#define CRAWL_DENTS_SIZE    262144 /* getdents64() buffer */
+#define CRAWL_CHECK_SEC     1    /* load and disk utilization sampling */
+#define DICT_BLOCK_NAMES    16   /* front coding restarts every so many names */
+#define DICT_SCAN_RATIO     2    /* nodes per distinct name to scan names */
+#define ACCESSLOG_RING_SIZE 1024 /* records per handler thread */
+#define ACCESSLOG_URL_SIZE  256  /* longer urls are cut */
+#define ACCESSLOG_BUFF_SIZE 65536
+#define ACCESSLOG_FLUSH_MS  100
 #define CONFIG_PATH         "search.cfg"
 
 #define DEFAULT_PORT        8888
 #define DEFAULT_TMPL_PATH   "index.htm.tmpl"
+#define DEFAULT_TIMEOUT     2000 /* query budget (ms) */
+#define DEFAULT_THREADS     4
+
+typedef struct {
+    char *path;
+    int period;     /* reindex period (seconds) */
+} root_t;
 
 /* config */
 extern unsigned short port;
-extern char *tmpl_path, *root, *app_subdir, *result_subdir;
-extern int magic_enable, period;
+extern char *tmpl_path, *app_subdir, *result_subdir;
+extern int magic_enable, period, timeout, threads, uring_depth;
+extern int crawl_idle, crawl_rate, crawl_dir_rate, crawl_max_util;
+extern double crawl_max_load;
+extern char *crawl_disk;
+extern root_t *roots;
+extern size_t nroots;
 
 
 int config_load(const char *conf_path);
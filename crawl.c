@@ -0,0 +1,541 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    crawl.c: Directory listing with batched metadata collection
+
+    Directories are read whole with large getdents64() calls, then every
+    entry is stat'ed. With a queue depth the stats are statx requests
+    submitted to an io_uring in batches and collected as they complete, so
+    slow storage works on many at once. Without one, or where io_uring is
+    not available, each entry is a plain fstatat().
+
+    Between directories the crawl paces itself to the configured rates and
+    waits while the load average or disk utilization is over its limit.
+
+*/
+
+#define _GNU_SOURCE
+#include "crawl.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <linux/io_uring.h>
+#include <linux/ioprio.h>
+
+#include "config.h"
+
+/* getdents64() record, not exported by the libc headers */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct crawl_s {
+    char *dents;                /* getdents64() buffer */
+    int ring;                   /* io_uring fd, -1 for fstatat() */
+    unsigned int depth;
+
+    crawl_opts_t opts;
+    size_t dirs, entries;
+    double start, paused;       /* seconds, monotonic */
+    double checked;             /* last load and utilization sample */
+    unsigned long io_ticks;     /* disk busy ms at the last sample */
+
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct statx *stx;          /* one per request in flight */
+    size_t *slot_entry;
+    unsigned *free_slots;
+};
+
+
+static void
+crawl_ring_close(crawl_t *crawl)
+{
+    if (crawl->ring < 0)
+        return;
+    munmap(crawl->sqes, crawl->sqes_size);
+    if (crawl->cq_map != crawl->sq_map)
+        munmap(crawl->cq_map, crawl->cq_map_size);
+    munmap(crawl->sq_map, crawl->sq_map_size);
+    close(crawl->ring);
+    crawl->ring = -1;
+}
+
+static int
+crawl_ring_open(crawl_t *crawl)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    crawl->ring = syscall(__NR_io_uring_setup, crawl->depth, &params);
+    if (crawl->ring < 0)
+        return -1;
+
+    /* statx needs 5.6, ask rather than guess from the version */
+    size_t probe_size = sizeof(struct io_uring_probe) +
+        256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = malloc(probe_size);
+    memset(probe, 0, probe_size);
+    int supported = syscall(__NR_io_uring_register, crawl->ring,
+        IORING_REGISTER_PROBE, probe, 256) == 0 &&
+        probe->last_op >= IORING_OP_STATX &&
+        (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    if (!supported) {
+        close(crawl->ring);
+        crawl->ring = -1;
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    crawl->sq_map_size = params.sq_off.array +
+        params.sq_entries * sizeof(unsigned);
+    crawl->cq_map_size = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (crawl->cq_map_size > crawl->sq_map_size)
+            crawl->sq_map_size = crawl->cq_map_size;
+        crawl->cq_map_size = crawl->sq_map_size;
+    }
+
+    crawl->sq_map = mmap(NULL, crawl->sq_map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, crawl->ring, IORING_OFF_SQ_RING);
+    crawl->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP) ?
+        crawl->sq_map : mmap(NULL, crawl->cq_map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, crawl->ring, IORING_OFF_CQ_RING);
+    crawl->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    crawl->sqes = mmap(NULL, crawl->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, crawl->ring, IORING_OFF_SQES);
+
+    if (crawl->sq_map == MAP_FAILED || crawl->cq_map == MAP_FAILED ||
+        crawl->sqes == MAP_FAILED)
+    {
+        int err = errno;
+        if (crawl->sqes != MAP_FAILED)
+            munmap(crawl->sqes, crawl->sqes_size);
+        if (crawl->cq_map != MAP_FAILED && crawl->cq_map != crawl->sq_map)
+            munmap(crawl->cq_map, crawl->cq_map_size);
+        if (crawl->sq_map != MAP_FAILED)
+            munmap(crawl->sq_map, crawl->sq_map_size);
+        close(crawl->ring);
+        crawl->ring = -1;
+        errno = err;
+        return -1;
+    }
+
+    char *sq = crawl->sq_map, *cq = crawl->cq_map;
+    crawl->sq_head = (unsigned*)(sq + params.sq_off.head);
+    crawl->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    crawl->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    crawl->sq_array = (unsigned*)(sq + params.sq_off.array);
+    crawl->cq_head = (unsigned*)(cq + params.cq_off.head);
+    crawl->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    crawl->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    crawl->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    /* the kernel rounds the depth up, keep within what was asked */
+    crawl->stx = malloc(sizeof(struct statx) * crawl->depth);
+    crawl->slot_entry = malloc(sizeof(size_t) * crawl->depth);
+    crawl->free_slots = malloc(sizeof(unsigned) * crawl->depth);
+    return 0;
+}
+
+/* idle i/o class and lowest cpu priority, for the calling thread only */
+void
+crawl_set_idle(void)
+{
+    if (syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+        IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) < 0)
+        fprintf(stderr, "[crawl] error ioprio_set(): %s\n", strerror(errno));
+    if (setpriority(PRIO_PROCESS, syscall(__NR_gettid), 19) < 0)
+        fprintf(stderr, "[crawl] error setpriority(): %s\n", strerror(errno));
+}
+
+static double
+now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 0.000000001 * ts.tv_nsec;
+}
+
+static void
+sleep_sec(double sec)
+{
+    struct timespec ts = { (time_t)sec, (long)((sec - (time_t)sec) * 1e9) };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+/* milliseconds the device spent doing i/o, from /proc/diskstats */
+static int
+disk_io_ticks(const char *disk, unsigned long *ticks)
+{
+    FILE *f = fopen("/proc/diskstats", "r");
+    if (!f)
+        return -1;
+
+    char line[512], name[64];
+    unsigned long v[10];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%*u %*u %63s %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+            name, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7],
+            &v[8], &v[9]) == 11 && strcmp(name, disk) == 0)
+        {
+            *ticks = v[9];
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found ? 0 : -1;
+}
+
+/* over the load or utilization limit since the last sample */
+static int
+crawl_busy(crawl_t *crawl, double now)
+{
+    int busy = 0;
+
+    double load;
+    if (crawl->opts.max_load > 0 && getloadavg(&load, 1) == 1 &&
+        load > crawl->opts.max_load)
+        busy = 1;
+
+    unsigned long ticks;
+    if (crawl->opts.max_util > 0 && crawl->opts.disk &&
+        disk_io_ticks(crawl->opts.disk, &ticks) == 0)
+    {
+        double util = (ticks - crawl->io_ticks) /
+            ((now - crawl->checked) * 10.0);
+        if (crawl->checked > 0 && util > crawl->opts.max_util)
+            busy = 1;
+        crawl->io_ticks = ticks;
+    }
+
+    crawl->checked = now;
+    return busy;
+}
+
+/* after each directory: progress, rate caps, then backing off */
+static void
+crawl_throttle(crawl_t *crawl, size_t entries)
+{
+    crawl->dirs++;
+    crawl->entries += entries;
+
+    crawl_progress_t *progress = crawl->opts.progress;
+    if (progress) {
+        atomic_store(&progress->dirs, crawl->dirs);
+        atomic_store(&progress->entries, crawl->entries);
+    }
+
+    /* the time the work done so far should take at the capped rates */
+    double due = 0.0;
+    if (crawl->opts.rate)
+        due = (double)crawl->entries / crawl->opts.rate;
+    if (crawl->opts.dir_rate &&
+        (double)crawl->dirs / crawl->opts.dir_rate > due)
+        due = (double)crawl->dirs / crawl->opts.dir_rate;
+
+    double now = now_sec();
+    double ran = now - crawl->start - crawl->paused;
+    if (due > ran) {
+        sleep_sec(due - ran);
+        now = now_sec();
+    }
+
+    if ((crawl->opts.max_load <= 0 && crawl->opts.max_util <= 0) ||
+        now - crawl->checked < CRAWL_CHECK_SEC)
+        return;
+
+    double pause_start = now;
+    while (crawl_busy(crawl, now)) {
+        if (progress)
+            atomic_store(&progress->paused, 1);
+        sleep_sec(CRAWL_CHECK_SEC);
+        now = now_sec();
+    }
+
+    /* paused time does not count against the rates */
+    crawl->paused += now - pause_start;
+    if (progress) {
+        atomic_store(&progress->paused, 0);
+        atomic_store(&progress->paused_ms, (long long)(crawl->paused * 1000));
+    }
+}
+
+crawl_t *
+crawl_new(const crawl_opts_t *opts)
+{
+    crawl_t *crawl = malloc(sizeof(crawl_t));
+    memset(crawl, 0, sizeof(crawl_t));
+    crawl->dents = malloc(CRAWL_DENTS_SIZE);
+    crawl->ring = -1;
+    crawl->depth = opts->depth;
+    crawl->opts = *opts;
+    crawl->start = now_sec();
+
+    if (opts->progress) {
+        atomic_store(&opts->progress->dirs, 0);
+        atomic_store(&opts->progress->entries, 0);
+        atomic_store(&opts->progress->paused, 0);
+        atomic_store(&opts->progress->paused_ms, 0);
+    }
+
+    if (opts->max_util > 0 && opts->disk &&
+        disk_io_ticks(opts->disk, &crawl->io_ticks) == 0)
+        crawl->checked = crawl->start;
+    else if (opts->max_util > 0)
+        fprintf(stderr, "[crawl] no disk %s in /proc/diskstats\n",
+            opts->disk ? opts->disk : "(none)");
+
+    if (crawl->depth && crawl_ring_open(crawl) < 0)
+        fprintf(stderr, "[crawl] io_uring unavailable (%s), using fstatat()\n",
+            strerror(errno));
+
+    return crawl;
+}
+
+const char *
+crawl_backend(const crawl_t *crawl)
+{
+    return crawl->ring >= 0 ? "io_uring statx" : "fstatat";
+}
+
+static void
+statx_to_stat(const struct statx *stx, struct stat *st)
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_nlink = stx->stx_nlink;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+    st->st_size = stx->stx_size;
+    st->st_blksize = stx->stx_blksize;
+    st->st_blocks = stx->stx_blocks;
+    st->st_atim.tv_sec = stx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+}
+
+/*
+ * Keeps up to depth statx requests in flight. Returns -1 if the ring
+ * failed, done marks what was collected before that.
+ */
+static int
+crawl_stat_ring(crawl_t *crawl, int dirfd, crawl_listing_t *listing,
+    char *done)
+{
+    size_t next = 0, inflight = 0;
+    unsigned nfree = crawl->depth, queued = 0;
+    for (unsigned i = 0; i < crawl->depth; i++)
+        crawl->free_slots[i] = i;
+
+    while (next < listing->size || inflight) {
+        /* fill the submission queue */
+        unsigned tail = *crawl->sq_tail;
+        while (next < listing->size && nfree) {
+            unsigned slot = crawl->free_slots[--nfree];
+            unsigned idx = tail & *crawl->sq_mask;
+            struct io_uring_sqe *sqe = &crawl->sqes[idx];
+
+            memset(sqe, 0, sizeof(struct io_uring_sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (uintptr_t)listing->entries[next].name;
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uintptr_t)&crawl->stx[slot];
+            sqe->user_data = slot;
+
+            crawl->sq_array[idx] = idx;
+            crawl->slot_entry[slot] = next++;
+            tail++;
+            queued++;
+            inflight++;
+        }
+        __atomic_store_n(crawl->sq_tail, tail, __ATOMIC_RELEASE);
+
+        int ret = syscall(__NR_io_uring_enter, crawl->ring, queued, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            return -1;
+        }
+        queued -= ret;
+
+        /* collect whatever completed */
+        unsigned head = *crawl->cq_head;
+        while (head != __atomic_load_n(crawl->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &crawl->cqes[head & *crawl->cq_mask];
+            unsigned slot = cqe->user_data;
+            size_t e = crawl->slot_entry[slot];
+            crawl_entry_t *entry = &listing->entries[e];
+
+            if (cqe->res < 0)
+                entry->error = -cqe->res;
+            else
+                statx_to_stat(&crawl->stx[slot], &entry->stat);
+            done[e] = 1;
+
+            crawl->free_slots[nfree++] = slot;
+            inflight--;
+            head++;
+        }
+        __atomic_store_n(crawl->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+int
+crawl_dir(crawl_t *crawl, const char *dir, crawl_listing_t *listing)
+{
+    memset(listing, 0, sizeof(crawl_listing_t));
+
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        return -1;
+
+    /* names first, by offset while the buffer grows */
+    size_t capacity = 0, names_size = 0, names_capacity = 0;
+    long n;
+    while ((n = syscall(__NR_getdents64, dirfd, crawl->dents,
+        CRAWL_DENTS_SIZE)) > 0)
+    {
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *de = (void*)(crawl->dents + off);
+            off += de->d_reclen;
+
+            if (de->d_name[0] == '.' && (de->d_name[1] == '\0' ||
+                (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+                continue;
+
+            size_t len = strlen(de->d_name) + 1;
+            if (names_size + len > names_capacity) {
+                while (names_size + len > names_capacity)
+                    names_capacity = names_capacity ? names_capacity * 2 :
+                        4096;
+                listing->names = realloc(listing->names, names_capacity);
+            }
+            memcpy(listing->names + names_size, de->d_name, len);
+
+            if (listing->size == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                listing->entries = realloc(listing->entries,
+                    sizeof(crawl_entry_t) * capacity);
+            }
+            crawl_entry_t *entry = &listing->entries[listing->size++];
+            memset(entry, 0, sizeof(crawl_entry_t));
+            entry->name = (const char*)(uintptr_t)names_size;
+            entry->type = de->d_type;
+            names_size += len;
+        }
+    }
+    if (n < 0) {
+        int err = errno;
+        close(dirfd);
+        crawl_listing_free(listing);
+        errno = err;
+        return -1;
+    }
+
+    for (size_t i = 0; i < listing->size; i++)
+        listing->entries[i].name = listing->names +
+            (uintptr_t)listing->entries[i].name;
+
+    /* then their metadata, batched when there is a ring */
+    char *done = calloc(listing->size ? listing->size : 1, 1);
+    if (crawl->ring >= 0 && listing->size &&
+        crawl_stat_ring(crawl, dirfd, listing, done) < 0)
+    {
+        fprintf(stderr, "[crawl] io_uring failed (%s), using fstatat()\n",
+            strerror(errno));
+        crawl_ring_close(crawl);
+    }
+
+    for (size_t i = 0; i < listing->size; i++) {
+        crawl_entry_t *entry = &listing->entries[i];
+        if (!done[i] && fstatat(dirfd, entry->name, &entry->stat, 0) < 0)
+            entry->error = errno;
+
+        /* no d_type on some filesystems, and a directory by stat may
+         * still be a symlink to one */
+        struct stat st;
+        if (!entry->error && entry->type == DT_UNKNOWN &&
+            S_ISDIR(entry->stat.st_mode) &&
+            fstatat(dirfd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            entry->type = S_ISLNK(st.st_mode) ? DT_LNK : DT_DIR;
+    }
+
+    free(done);
+    close(dirfd);
+
+    crawl_throttle(crawl, listing->size);
+    return 0;
+}
+
+void
+crawl_listing_free(crawl_listing_t *listing)
+{
+    free(listing->entries);
+    free(listing->names);
+    memset(listing, 0, sizeof(crawl_listing_t));
+}
+
+void
+crawl_destroy(crawl_t *crawl)
+{
+    crawl_ring_close(crawl);
+    free(crawl->stx);
+    free(crawl->slot_entry);
+    free(crawl->free_slots);
+    free(crawl->dents);
+    free(crawl);
+}
+
@@ -0,0 +1,70 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    crawl.c: Directory listing with batched metadata collection
+
+*/
+
+#ifndef _CRAWL_H
+#define _CRAWL_H
+
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct {
+    const char *name;
+    unsigned char type;         /* DT_* from the directory entry, a hint */
+    int error;                  /* errno of a failed stat, 0 */
+    struct stat stat;
+} crawl_entry_t;
+
+/* one directory, entries are valid until crawl_listing_free() */
+typedef struct {
+    crawl_entry_t *entries;
+    size_t size;
+    char *names;
+} crawl_listing_t;
+
+/* live counters of a running crawl */
+typedef struct {
+    atomic_size_t dirs, entries;
+    atomic_int paused;          /* waiting for the system to calm down */
+    atomic_llong paused_ms;
+} crawl_progress_t;
+
+typedef struct {
+    unsigned int depth;         /* io_uring queue depth, 0 for fstatat() */
+    unsigned int rate, dir_rate; /* entries and directories/s, 0 unlimited */
+    double max_load;            /* pause above this load average, 0 never */
+    int max_util;               /* pause above this disk busy %, 0 never */
+    const char *disk;           /* device for max_util, as in /proc/diskstats */
+    crawl_progress_t *progress; /* NULL for none */
+} crawl_opts_t;
+
+typedef struct crawl_s crawl_t;
+
+void crawl_set_idle(void);
+crawl_t *crawl_new(const crawl_opts_t *opts);
+const char *crawl_backend(const crawl_t *crawl);
+int crawl_dir(crawl_t *crawl, const char *dir, crawl_listing_t *listing);
+void crawl_listing_free(crawl_listing_t *listing);
+void crawl_destroy(crawl_t *crawl);
+
+#endif /* _CRAWL_H */
+
@@ -0,0 +1,91 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    deadline.c: Per query time budget and cancellation
+
+    Lookups poll the deadline every few nodes. Past the budget they stop with
+    what they have, and the client socket is peeked now and then so that a
+    lookup nobody is waiting for stops too.
+
+*/
+
+#include "deadline.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <time.h>
+
+#include "config.h"
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void
+deadline_init(deadline_t *deadline, long budget_ms, int fd)
+{
+    long long now = now_ns();
+    deadline->at = budget_ms > 0 ? now + budget_ms * 1000000LL : 0;
+    deadline->budget = budget_ms > 0 ? budget_ms : 0;
+    deadline->fd = fd;
+    atomic_init(&deadline->next_probe, now + DEADLINE_PROBE_MS * 1000000LL);
+    atomic_init(&deadline->state, DEADLINE_RUNNING);
+}
+
+/* orderly shutdown or reset from the peer, pipelined data is fine */
+static int
+client_gone(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n == 0)
+        return 1;
+    return n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+}
+
+int
+deadline_check(deadline_t *deadline)
+{
+    if (atomic_load(&deadline->state) != DEADLINE_RUNNING)
+        return 1;
+
+    long long now = now_ns();
+    if (deadline->at && now >= deadline->at) {
+        atomic_store(&deadline->state, DEADLINE_EXPIRED);
+        return 1;
+    }
+
+    /* one probing thread per interval */
+    long long probe = atomic_load(&deadline->next_probe);
+    if (deadline->fd >= 0 && now >= probe &&
+        atomic_compare_exchange_strong(&deadline->next_probe, &probe,
+            now + DEADLINE_PROBE_MS * 1000000LL) &&
+        client_gone(deadline->fd))
+    {
+        atomic_store(&deadline->state, DEADLINE_CANCELLED);
+        return 1;
+    }
+
+    return 0;
+}
+
@@ -0,0 +1,47 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    deadline.c: Per query time budget and cancellation
+
+*/
+
+#ifndef _DEADLINE_H
+#define _DEADLINE_H
+
+#include <stdatomic.h>
+
+typedef enum {
+    DEADLINE_RUNNING,
+    DEADLINE_EXPIRED,           /* budget used up, results are partial */
+    DEADLINE_CANCELLED          /* client went away */
+} deadline_state_t;
+
+/* shared by every shard job of a lookup */
+typedef struct {
+    long long at;               /* CLOCK_MONOTONIC ns, 0 for no budget */
+    long budget;                /* ms it was given, 0 for none */
+    int fd;                     /* client socket, -1 for none */
+    atomic_llong next_probe;
+    atomic_int state;
+} deadline_t;
+
+void deadline_init(deadline_t *deadline, long budget_ms, int fd);
+int deadline_check(deadline_t *deadline);
+
+#endif /* _DEADLINE_H */
+
@@ -0,0 +1,192 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    dict.c: Front coded dictionary of file names
+
+    Names are sorted and every one after the first of its block is stored as
+    the length of the prefix it shares with the previous name and the rest.
+    Both lengths are varints, a byte each for names up to 127 bytes. Scans
+    decode the blocks in order, a lookup binary searches the block heads.
+
+*/
+
+#include "dict.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+
+/* 7 bits per byte, low first, high bit set on all but the last */
+static size_t
+varint_size(size_t v)
+{
+    size_t size = 1;
+    for (; v >= 0x80; v >>= 7)
+        size++;
+    return size;
+}
+
+static unsigned char *
+varint_put(unsigned char *p, size_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        *p++ = v | 0x80;
+    *p++ = v;
+    return p;
+}
+
+static const unsigned char *
+varint_get(const unsigned char *p, size_t *v)
+{
+    *v = 0;
+    for (int shift = 0; ; shift += 7) {
+        *v |= (size_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+}
+
+dict_t *
+dict_new(const char **names, size_t n)
+{
+    dict_t *dict = malloc(sizeof(dict_t));
+    dict->size = n;
+    dict->nblocks = (n + DICT_BLOCK_NAMES - 1) / DICT_BLOCK_NAMES;
+    dict->blocks = malloc(sizeof(size_t) * (dict->nblocks + 1));
+    dict->maxlen = 0;
+
+    /* sized for whole names, shrunk to the front coded size below */
+    size_t size = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(names[i]);
+        size += 1 + varint_size(len) + len;
+        if (len > dict->maxlen)
+            dict->maxlen = len;
+    }
+    dict->data = malloc(size + 1);
+
+    unsigned char *p = dict->data;
+    const char *prev = "";
+    for (size_t i = 0; i < n; i++) {
+        size_t lcp = 0, len = strlen(names[i]);
+        if (i % DICT_BLOCK_NAMES == 0)
+            dict->blocks[i / DICT_BLOCK_NAMES] = p - dict->data;
+        else
+            while (prev[lcp] && prev[lcp] == names[i][lcp])
+                lcp++;
+
+        p = varint_put(p, lcp);
+        p = varint_put(p, len - lcp);
+        memcpy(p, names[i] + lcp, len - lcp);
+        p += len - lcp;
+        prev = names[i];
+    }
+
+    size = p - dict->data;
+    dict->data = realloc(dict->data, size ? size : 1);
+    dict->bytes = sizeof(dict_t) + size + sizeof(size_t) * (dict->nblocks + 1);
+    return dict;
+}
+
+/* id of name, -1 if not in the dictionary */
+long
+dict_find(const dict_t *dict, const char *name)
+{
+    if (!dict->size)
+        return -1;
+
+    /* last block whose head is not past name, heads are stored whole */
+    size_t len = strlen(name), lo = 0, hi = dict->nblocks;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        size_t hlen;
+        const unsigned char *head = varint_get(
+            dict->data + dict->blocks[mid] + 1, &hlen);
+        int cmp = memcmp(name, head, len < hlen ? len : hlen);
+        if (cmp > 0 || (cmp == 0 && len >= hlen))
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    /* no name in the dictionary is longer */
+    if (len > dict->maxlen)
+        return -1;
+
+    dict_iter_t iter;
+    dict_iter_init(&iter, dict);
+    iter.p = dict->data + dict->blocks[lo];
+    iter.next = lo * DICT_BLOCK_NAMES;
+
+    long id = -1;
+    for (size_t i = 0; i < DICT_BLOCK_NAMES && dict_next(&iter); i++) {
+        int cmp = strcmp(iter.name, name);
+        if (cmp == 0)
+            id = iter.id;
+        if (cmp >= 0)
+            break;
+    }
+    dict_iter_free(&iter);
+    return id;
+}
+
+void
+dict_iter_init(dict_iter_t *iter, const dict_t *dict)
+{
+    iter->dict = dict;
+    iter->p = dict->data;
+    iter->next = 0;
+    iter->name = dict->maxlen > NAME_MAX ? malloc(dict->maxlen + 1) :
+        iter->buff;
+}
+
+/* the next name, NULL past the last one */
+const char *
+dict_next(dict_iter_t *iter)
+{
+    if (iter->next >= iter->dict->size)
+        return NULL;
+
+    size_t lcp, len;
+    const unsigned char *p = varint_get(varint_get(iter->p, &lcp), &len);
+    memcpy(iter->name + lcp, p, len);
+    iter->len = lcp + len;
+    iter->name[iter->len] = '\0';
+    iter->p = p + len;
+    iter->id = iter->next++;
+    return iter->name;
+}
+
+void
+dict_iter_free(dict_iter_t *iter)
+{
+    if (iter->name != iter->buff)
+        free(iter->name);
+}
+
+void
+dict_destroy(dict_t *dict)
+{
+    if (!dict)
+        return;
+    free(dict->data);
+    free(dict->blocks);
+    free(dict);
+}
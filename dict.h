@@ -0,0 +1,55 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    dict.c: Front coded dictionary of file names
+
+*/
+
+#ifndef _DICT_H
+#define _DICT_H
+
+#include <stddef.h>
+#include <limits.h>
+
+/* sorted distinct names, the id of a name is its rank */
+typedef struct {
+    unsigned char *data;        /* per name: prefix length, suffix length, suffix */
+    size_t *blocks;             /* offset of every DICT_BLOCK_NAMES-th name */
+    size_t size, nblocks;
+    size_t maxlen;              /* of the longest name */
+    size_t bytes;               /* memory used */
+} dict_t;
+
+/* decodes the names in id order, one at a time */
+typedef struct {
+    const dict_t *dict;
+    const unsigned char *p;
+    size_t next;
+    size_t id, len;             /* of the name last returned */
+    char *name;                 /* buff, or malloc()'d for longer names */
+    char buff[NAME_MAX + 1];
+} dict_iter_t;
+
+dict_t *dict_new(const char **names, size_t n);
+long dict_find(const dict_t *dict, const char *name);
+void dict_iter_init(dict_iter_t *iter, const dict_t *dict);
+const char *dict_next(dict_iter_t *iter);
+void dict_iter_free(dict_iter_t *iter);
+void dict_destroy(dict_t *dict);
+
+#endif /* _DICT_H */
@@ -29,10 +29,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include <magic.h>
 
 #include "config.h"
+#include "query.h"
+#include "acm.h"
+#include "dict.h"
+#include "crawl.h"
 
 /* closed addressing map */
 typedef struct map_s {
@@ -46,8 +55,55 @@ struct node_s {
     map_t *child;
 };
 
+/* interned strings, shared by all indexes so ids are stable, 0 is none */
+typedef struct {
+    char **strs;
+    size_t count, capacity;
+    unsigned int *slots;
+    size_t nslots;
+    pthread_mutex_t lock;
+} strtab_t;
 
-static magic_t magic_cookie = NULL;
+typedef struct {
+    const node_data_t **nodes;
+    size_t size, capacity;
+} nodevec_t;
+
+/* case folded characters and bigrams of every name below a directory */
+typedef struct summary_s {
+    uint64_t chars;
+    uint64_t bigrams[4];
+} summary_t;
+
+struct batch_s {
+    size_t n;
+    const lookup_type_t *types;
+    const char **patterns;
+    acm_t *substr, *nocase;     /* NULL without such patterns */
+    size_t *substr_ids, *nocase_ids;   /* automaton pattern to batch index */
+};
+
+struct index_s {
+    map_t *root;
+    nodevec_t nodes;        /* DFS preorder, a subtree is a contiguous range */
+    nodevec_t *ext_nodes;   /* extension id to nodes */
+    size_t ext_nodes_size;
+    dict_t *names;          /* distinct names, front coded */
+    size_t *name_heads;     /* name id to first node id + 1 */
+    size_t *name_next;      /* node id to the next with its name, id + 1 */
+    unsigned int *name_slots;   /* name hash to name id + 1 */
+    size_t name_nslots;
+    atomic_size_t refs;     /* results pointing into it, and its owner */
+    magic_t magic;          /* per crawl, cookies are not thread safe */
+    crawl_t *crawl;         /* per crawl listing and stat backend */
+    size_t strip;           /* root prefix length removed from paths */
+};
+
+
+static magic_t magic_cookie = NULL;   /* checked at init */
+
+static strtab_t ext_tab = { .lock = PTHREAD_MUTEX_INITIALIZER },
+    mime_tab = { .lock = PTHREAD_MUTEX_INITIALIZER };
 
 
 size_t
@@ -93,14 +149,210 @@ map_insert(map_t *map, const char *key, node_data_t *data, map_t *child)
     map->count++;
 }
 
-results_t *
-results_new()
+static unsigned int
+strtab_find_locked(const strtab_t *tab, const char *s)
+{
+    if (!tab->nslots)
+        return 0;
+    for (size_t i = hash(s, tab->nslots); tab->slots[i];
+        i = (i + 1) % tab->nslots)
+    {
+        if (strcmp(tab->strs[tab->slots[i]], s) == 0)
+            return tab->slots[i];
+    }
+    return 0;
+}
+
+static unsigned int
+strtab_find(strtab_t *tab, const char *s)
+{
+    pthread_mutex_lock(&tab->lock);
+    unsigned int id = strtab_find_locked(tab, s);
+    pthread_mutex_unlock(&tab->lock);
+    return id;
+}
+
+static unsigned int
+strtab_intern(strtab_t *tab, const char *s)
+{
+    pthread_mutex_lock(&tab->lock);
+
+    unsigned int id = strtab_find_locked(tab, s);
+    if (id) {
+        pthread_mutex_unlock(&tab->lock);
+        return id;
+    }
+
+    if (tab->count == 0)
+        tab->count = 1; /* reserve none */
+
+    if (tab->count + 1 >= tab->capacity) {
+        tab->capacity = tab->capacity ? tab->capacity * 2 : INIT_VEC_CAPACITY;
+        tab->strs = realloc(tab->strs, sizeof(char*) * tab->capacity);
+        tab->strs[0] = NULL;
+    }
+
+    /* keep load factor under 1/2 */
+    if (2 * (tab->count + 1) >= tab->nslots) {
+        free(tab->slots);
+        tab->nslots = tab->nslots ? tab->nslots * 2 : INIT_MAP_CAPACITY;
+        tab->slots = malloc(sizeof(unsigned int) * tab->nslots);
+        memset(tab->slots, 0, sizeof(unsigned int) * tab->nslots);
+        for (unsigned int i = 1; i < tab->count; i++) {
+            size_t j = hash(tab->strs[i], tab->nslots);
+            for (; tab->slots[j]; j = (j + 1) % tab->nslots);
+            tab->slots[j] = i;
+        }
+    }
+
+    id = tab->count++;
+    tab->strs[id] = strdup(s);
+    size_t j = hash(s, tab->nslots);
+    for (; tab->slots[j]; j = (j + 1) % tab->nslots);
+    tab->slots[j] = id;
+
+    pthread_mutex_unlock(&tab->lock);
+    return id;
+}
+
+static size_t
+strtab_count(strtab_t *tab)
+{
+    pthread_mutex_lock(&tab->lock);
+    size_t count = tab->count ? tab->count : 1;
+    pthread_mutex_unlock(&tab->lock);
+    return count;
+}
+
+static void
+nodevec_insert(nodevec_t *vec, const node_data_t *data)
+{
+    if (vec->size + 1 >= vec->capacity) {
+        vec->capacity = vec->capacity ? vec->capacity * 2 : 16;
+        vec->nodes = realloc(vec->nodes, sizeof(node_data_t*) * vec->capacity);
+    }
+    vec->nodes[vec->size++] = data;
+}
+
+/* lowercase extension, too long ones are not extensions */
+static int
+extension(const char *name, char *ext)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name || dot[1] == '\0' ||
+        strlen(dot + 1) > EXT_MAX_LEN)
+        return -1;
+    for (dot++; *dot; dot++)
+        *ext++ = tolower((unsigned char)*dot);
+    *ext = '\0';
+    return 0;
+}
+
+unsigned int
+index_ext_id(const char *ext)
 {
-    results_t *r = malloc(sizeof(results_t));
+    char lower[EXT_MAX_LEN + 1];
+    if (strlen(ext) > EXT_MAX_LEN)
+        return 0;
+    for (size_t i = 0; (lower[i] = tolower((unsigned char)ext[i])); i++);
+    return strtab_find(&ext_tab, lower);
+}
+
+/* letters and digits get their own bit, the rest share the remaining ones */
+static unsigned int
+summary_fold(unsigned char c)
+{
+    c = tolower(c);
+    if (c >= 'a' && c <= 'z')
+        return c - 'a';
+    if (c >= '0' && c <= '9')
+        return 26 + c - '0';
+    return 36 + c % 28;
+}
+
+static void
+summary_add(summary_t *summary, const char *name)
+{
+    unsigned int prev = 0;
+    for (int first = 1; *name; name++, first = 0) {
+        unsigned int c = summary_fold(*name);
+        summary->chars |= 1ULL << c;
+        if (!first) {
+            uint32_t bigram = ((prev << 6) | c) * 2654435761U >> 24;
+            summary->bigrams[bigram >> 6] |= 1ULL << (bigram & 63);
+        }
+        prev = c;
+    }
+}
+
+static void
+summary_merge(summary_t *dst, const summary_t *src)
+{
+    dst->chars |= src->chars;
+    for (int i = 0; i < 4; i++)
+        dst->bigrams[i] |= src->bigrams[i];
+}
+
+/* whether a name below could contain every character and bigram of query */
+static int
+summary_covers(const summary_t *summary, const summary_t *query)
+{
+    if ((summary->chars & query->chars) != query->chars)
+        return 0;
+    for (int i = 0; i < 4; i++)
+        if ((summary->bigrams[i] & query->bigrams[i]) != query->bigrams[i])
+            return 0;
+    return 1;
+}
+
+/* results memory comes from the request arena when there is one */
+static void *
+results_alloc(results_t *results, size_t size)
+{
+    return results->arena ? arena_alloc(results->arena, size) : malloc(size);
+}
+
+static void *
+results_realloc(results_t *results, void *ptr, size_t old, size_t size)
+{
+    return results->arena ? arena_realloc(results->arena, ptr, old, size) :
+        realloc(ptr, size);
+}
+
+static void
+results_free(results_t *results, void *ptr)
+{
+    if (!results->arena)
+        free(ptr);
+}
+
+/* bare hit list, no facets and no vector until the first insert */
+static results_t *
+results_new_hits(arena_t *arena)
+{
+    results_t *r = arena ? arena_alloc(arena, sizeof(results_t)) :
+        malloc(sizeof(results_t));
+    memset(r, 0, sizeof(results_t));
+    r->arena = arena;
+    return r;
+}
+
+static results_t *
+results_new(arena_t *arena)
+{
+    results_t *r = results_new_hits(arena);
+
+    /* nodes of published indexes only hold ids below the current count */
+    r->nfacets[FACET_EXT] = strtab_count(&ext_tab);
+    r->nfacets[FACET_MIME] = strtab_count(&mime_tab);
+    for (int i = 0; i < FACET_MAX; i++) {
+        r->facets[i] = results_alloc(r, sizeof(size_t) * r->nfacets[i]);
+        memset(r->facets[i], 0, sizeof(size_t) * r->nfacets[i]);
+    }
+
+    /* last, so it can grow in place */
     r->capacity = INIT_VEC_CAPACITY;
-    r->results = malloc(sizeof(node_data_t*) * r->capacity);
-    memset(r->results, 0, sizeof(node_data_t*) * r->capacity);
-    r->size = 0;
+    r->results = results_alloc(r, sizeof(node_data_t*) * r->capacity);
     return r;
 }
 
@@ -108,21 +360,109 @@ void
 results_insert(results_t *results, const node_data_t *result)
 {
     if (results->size + 1 >= results->capacity) {
-        results->capacity *= 2;
-        results->results = realloc(results->results, sizeof(node_data_t*) *
-            results->capacity);
+        size_t capacity = results->capacity ? results->capacity * 2 :
+            INIT_HITS_CAPACITY;
+        results->results = results_realloc(results, results->results,
+            sizeof(node_data_t*) * results->capacity,
+            sizeof(node_data_t*) * capacity);
+        results->capacity = capacity;
     }
 
     results->results[results->size++] = result;
+
+    /* facets are counted in the matching pass, bare hit lists have none */
+    if (result->ext_id < results->nfacets[FACET_EXT])
+        results->facets[FACET_EXT][result->ext_id]++;
+    if (result->mime_id < results->nfacets[FACET_MIME])
+        results->facets[FACET_MIME][result->mime_id]++;
 }
 
-static int
-cmp_results(const void *_r1, const void *_r2, void *arg)
+size_t
+results_facets(const results_t *results, facet_type_t type, facet_t *top,
+    size_t n)
 {
-    const node_data_t *r1 = *(node_data_t**)_r1, *r2 = *(node_data_t**)_r2;
-    sort_type_t sort_type = ((int*)arg)[0];
-    int desc = ((int*)arg)[1];
+    strtab_t *tab = type == FACET_EXT ? &ext_tab : &mime_tab;
+    size_t ntop = 0;
+
+    pthread_mutex_lock(&tab->lock);
+    for (size_t id = 1; id < results->nfacets[type]; id++) {
+        size_t count = results->facets[type][id];
+        if (!count || (ntop == n && count <= top[n - 1].count))
+            continue;
+
+        /* insertion into the small sorted top */
+        size_t i = ntop < n ? ntop++ : n - 1;
+        for (; i > 0 && top[i - 1].count < count; i--)
+            top[i] = top[i - 1];
+        top[i].value = tab->strs[id];
+        top[i].count = count;
+    }
+    pthread_mutex_unlock(&tab->lock);
+
+    return ntop;
+}
+
+/* keep the index alive for as long as the results point into it */
+static void
+results_hold(results_t *results, index_t index)
+{
+    index_ref(index);
+    results->indexes = results_realloc(results, results->indexes,
+        sizeof(index_t) * results->nindexes,
+        sizeof(index_t) * (results->nindexes + 1));
+    results->indexes[results->nindexes++] = index;
+}
+
+static void
+results_move_indexes(results_t *dst, results_t *src)
+{
+    if (!src->nindexes)
+        return;
+    dst->indexes = results_realloc(dst, dst->indexes,
+        sizeof(index_t) * dst->nindexes,
+        sizeof(index_t) * (dst->nindexes + src->nindexes));
+    memcpy(&dst->indexes[dst->nindexes], src->indexes,
+        sizeof(index_t) * src->nindexes);
+    dst->nindexes += src->nindexes;
+    results_free(src, src->indexes);
+    src->indexes = NULL;
+    src->nindexes = 0;
+}
+
+/* private copy of shared results, holding its own index references */
+results_t *
+results_copy(const results_t *results, arena_t *arena)
+{
+    results_t *copy = results_new(arena);
 
+    if (results->size + 1 > copy->capacity) {
+        copy->results = results_realloc(copy, copy->results,
+            sizeof(node_data_t*) * copy->capacity,
+            sizeof(node_data_t*) * (results->size + 1));
+        copy->capacity = results->size + 1;
+    }
+    memcpy(copy->results, results->results,
+        sizeof(node_data_t*) * results->size);
+    copy->size = results->size;
+    copy->partial = results->partial;
+
+    for (int type = 0; type < FACET_MAX; type++) {
+        size_t count = results->nfacets[type] < copy->nfacets[type] ?
+            results->nfacets[type] : copy->nfacets[type];
+        memcpy(copy->facets[type], results->facets[type],
+            sizeof(size_t) * count);
+    }
+
+    for (size_t i = 0; i < results->nindexes; i++)
+        results_hold(copy, results->indexes[i]);
+
+    return copy;
+}
+
+static int
+cmp_node(const node_data_t *r1, const node_data_t *r2, sort_type_t sort_type,
+    int desc)
+{
     int cmp = 0;
 
     switch (sort_type) {
@@ -133,21 +473,31 @@ cmp_results(const void *_r1, const void *_r2, void *arg)
         cmp = strcmp(r1->path, r2->path);
     break;
     case SORT_MIME:
-        if (!r1->mime)
-            return 0;
-        cmp = strcmp(r1->mime, r2->mime);
+        cmp = strcmp(r1->mime ? r1->mime : "", r2->mime ? r2->mime : "");
     break;
     case SORT_SIZE:
-        cmp = r1->stat.st_size - r2->stat.st_size;
+        cmp = (r1->stat.st_size > r2->stat.st_size) -
+            (r1->stat.st_size < r2->stat.st_size);
     break;
     case SORT_TIME:
-        cmp = r1->stat.st_mtime - r2->stat.st_mtime;
+        cmp = (r1->stat.st_mtime > r2->stat.st_mtime) -
+            (r1->stat.st_mtime < r2->stat.st_mtime);
     break;
     }
     
     return !desc ? cmp : -cmp;
 }
 
+static int
+cmp_results(const void *_r1, const void *_r2, void *arg)
+{
+    const node_data_t *r1 = *(node_data_t**)_r1, *r2 = *(node_data_t**)_r2;
+    sort_type_t sort_type = ((int*)arg)[0];
+    int desc = ((int*)arg)[1];
+
+    return cmp_node(r1, r2, sort_type, desc);
+}
+
 void
 results_sort(results_t *results, sort_type_t sort_type, int desc)
 {
@@ -156,30 +506,71 @@ results_sort(results_t *results, sort_type_t sort_type, int desc)
         &arg);
 }
 
+/* k-way merge of results sorted with the same order, consumes them */
 results_t *
-results_filter(results_t *results, const filter_t *filter)
+results_merge(results_t **parts, size_t n, sort_type_t sort_type, int desc,
+    arena_t *arena)
 {
-    results_t *filtered = results_new();
-    for (size_t i = 0; i < results->size; i++) {
-        const node_data_t *n = results->results[i];
-        if (filter->time_low && (n->stat.st_mtime < filter->time_low))
-            continue;
-        if (filter->time_high && (n->stat.st_mtime > filter->time_high))
-            continue;
-        if (filter->size_low && (n->stat.st_size < filter->size_low))
-            continue;
-        if (filter->size_high && (n->stat.st_size > filter->size_high))
-            continue;
+    /* bare hit lists merge into a bare hit list */
+    results_t *merged = n && !parts[0]->nfacets[FACET_EXT] ?
+        results_new_hits(arena) : results_new(arena);
+
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += parts[i]->size;
+    if (total && total + 1 > merged->capacity) {
+        merged->results = results_realloc(merged, merged->results,
+            sizeof(node_data_t*) * merged->capacity,
+            sizeof(node_data_t*) * (total + 1));
+        merged->capacity = total + 1;
+    }
+
+    size_t *pos = results_alloc(merged, sizeof(size_t) * n);
+    memset(pos, 0, sizeof(size_t) * n);
+
+    for (;;) {
+        size_t min = n;
+        for (size_t i = 0; i < n; i++) {
+            if (pos[i] == parts[i]->size)
+                continue;
+            if (min == n || cmp_node(parts[i]->results[pos[i]],
+                parts[min]->results[pos[min]], sort_type, desc) < 0)
+                min = i;
+        }
+        if (min == n)
+            break;
+        merged->results[merged->size++] = parts[min]->results[pos[min]++];
+    }
+    results_free(merged, pos);
 
-        results_insert(filtered, n);
+    /* facets add up, parts may predate some interned ids */
+    for (size_t i = 0; i < n; i++) {
+        for (int type = 0; type < FACET_MAX; type++) {
+            size_t count = parts[i]->nfacets[type] < merged->nfacets[type] ?
+                parts[i]->nfacets[type] : merged->nfacets[type];
+            for (size_t id = 0; id < count; id++)
+                merged->facets[type][id] += parts[i]->facets[type][id];
+        }
+        merged->partial |= parts[i]->partial;
+        results_move_indexes(merged, parts[i]);
+        results_destroy(parts[i]);
     }
-    results_destroy(results);
-    return filtered;
+
+    return merged;
 }
 
 void
 results_destroy(results_t *results)
 {
+    for (size_t i = 0; i < results->nindexes; i++)
+        index_unref(results->indexes[i]);
+
+    /* arena memory goes back with the arena */
+    if (results->arena)
+        return;
+    free(results->indexes);
+    for (int i = 0; i < FACET_MAX; i++)
+        free(results->facets[i]);
     free(results->results);
     free(results);
 }
@@ -207,10 +598,11 @@ index_deinit()
 }
 
 map_t *
-index_recurse(size_t size, const char *dir, int examine, size_t rootlen)
+index_recurse(index_t index, size_t size, const char *dir, summary_t *summary)
 {
-    DIR *dirp = opendir(dir);
-    if (!dirp) {
+    /* the whole directory listed and stat'ed at once */
+    crawl_listing_t listing;
+    if (crawl_dir(index->crawl, dir, &listing) < 0) {
         fprintf(stderr, "[index] error opening directory %s: %s\n", dir,
             strerror(errno));
         return NULL;
@@ -219,143 +611,720 @@ index_recurse(size_t size, const char *dir, int examine, size_t rootlen)
     map_t *map = map_new(size);
 
     char path[4096];
-    struct dirent *de = NULL;
-    while ((de = readdir(dirp))) {
-        if (de->d_name[0] == '.') {
-            if (de->d_name[1] == '\0')
-                continue;
-            else if (de->d_name[1] == '.')
-                if (de->d_name[2] == '\0')
-                    continue;
-        }
+    for (size_t i = 0; i < listing.size; i++) {
+        const crawl_entry_t *de = &listing.entries[i];
 
-        snprintf(path, 4096, "%s/%s", dir, de->d_name);
+        snprintf(path, 4096, "%s/%s", dir, de->name);
 
-        /* stat it */
-        node_data_t *data = malloc(sizeof(node_data_t));
-        memset(data, 0, sizeof(node_data_t));
-        data->name = strdup(de->d_name);
-        data->path = strdup(&path[rootlen]);
-        if (stat(path, &data->stat) < 0) {
+        if (de->error) {
             fprintf(stderr, "[index] error stat() %s: %s\n", path,
-                strerror(errno));
-            free(data);
-            data = NULL;
+                strerror(de->error));
+            continue;
         }
 
+        node_data_t *data = malloc(sizeof(node_data_t));
+        memset(data, 0, sizeof(node_data_t));
+        /* the name is the tail of the path */
+        data->path = strdup(&path[index->strip]);
+        data->name = data->path + strlen(data->path) - strlen(de->name);
+        data->stat = de->stat;
+
         /* examine */
-        if (examine) {
-            const char *mime = magic_file(magic_cookie, path);
+        if (index->magic) {
+            const char *mime = magic_file(index->magic, path);
             if (!mime) {
                 fprintf(stderr, "[index] error magic_file() %s: %s\n", path,
-                    magic_error(magic_cookie));
-            } else 
-                data->mime = strdup(mime);
+                    magic_error(index->magic));
+            } else {
+                data->mime_id = strtab_intern(&mime_tab, mime);
+                pthread_mutex_lock(&mime_tab.lock);
+                data->mime = mime_tab.strs[data->mime_id];
+                pthread_mutex_unlock(&mime_tab.lock);
+            }
         } 
 
-        /* recurse */
+        /* intern extension */
+        char ext[EXT_MAX_LEN + 1];
+        if (extension(de->name, ext) == 0) {
+            data->ext_id = strtab_intern(&ext_tab, ext);
+            if (data->ext_id >= index->ext_nodes_size) {
+                size_t newsize = data->ext_id * 2;
+                index->ext_nodes = realloc(index->ext_nodes,
+                    sizeof(nodevec_t) * newsize);
+                memset(&index->ext_nodes[index->ext_nodes_size], 0,
+                    sizeof(nodevec_t) * (newsize - index->ext_nodes_size));
+                index->ext_nodes_size = newsize;
+            }
+            nodevec_insert(&index->ext_nodes[data->ext_id], data);
+        }
+
+        /* recurse, descendants follow the directory in the node order */
+        data->id = index->nodes.size;
+        nodevec_insert(&index->nodes, data);
+
         map_t *child = NULL;
-        if (de->d_type == DT_DIR) {
-            child = index_recurse(size, path, examine, rootlen);
+        /* stat decides, d_type only keeps symlinks out */
+        if (S_ISDIR(de->stat.st_mode) && de->type != DT_LNK) {
+            data->summary = malloc(sizeof(summary_t));
+            memset(data->summary, 0, sizeof(summary_t));
+            child = index_recurse(index, size, path, data->summary);
+            summary_merge(summary, data->summary);
         }
+        summary_add(summary, de->name);
+
+        data->end = index->nodes.size;
 
-        map_insert(map, de->d_name, data, child);
+        map_insert(map, data->name, data, child);
     }
 
-    closedir(dirp);
+    crawl_listing_free(&listing);
 
     return map;
 }
 
-map_t *
-index_new(size_t size, const char *dir, int examine) {
-    return index_recurse(size, dir, examine, strlen(dir) + 1);
+static int
+name_cmp(const void *p1, const void *p2)
+{
+    const node_data_t *r1 = *(const node_data_t**)p1;
+    const node_data_t *r2 = *(const node_data_t**)p2;
+    return strcmp(r1->name, r2->name);
 }
 
-void
-index_lookup_substr(map_t *index, const char *query,
-    results_t *results)
+/* distinct names of every directory, and the nodes of each name */
+static void
+index_dict_names(index_t index)
 {
-    for (size_t i = 0; i < index->size; i++) {
-        if (!index->map[i].data)
-            continue;
+    size_t n = index->nodes.size;
+    const node_data_t **sorted = malloc(sizeof(node_data_t*) * (n + 1));
+    const char **names = malloc(sizeof(char*) * (n + 1));
+    memcpy(sorted, index->nodes.nodes, sizeof(node_data_t*) * n);
+    qsort(sorted, n, sizeof(node_data_t*), name_cmp);
 
-        for (struct node_s *node = &index->map[i]; node; node = node->next) {
-            if (strstr(node->data->name, query))
-                results_insert(results, node->data);
-            if (node->child)
-                index_lookup_substr(node->child, query, results);
+    size_t ndistinct = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || strcmp(sorted[i]->name, sorted[i - 1]->name) != 0)
+            names[ndistinct++] = sorted[i]->name;
+        ((node_data_t*)sorted[i])->name_id = ndistinct - 1;
+    }
+
+    index->names = dict_new(names, ndistinct);
+
+    /* exact lookups probe a hash of the names, not the dictionary */
+    index->name_nslots = 2 * ndistinct + 1;
+    index->name_slots = calloc(index->name_nslots, sizeof(unsigned int));
+    for (size_t id = 0; id < ndistinct; id++) {
+        size_t slot = hash(names[id], index->name_nslots);
+        while (index->name_slots[slot])
+            slot = (slot + 1) % index->name_nslots;
+        index->name_slots[slot] = id + 1;
+    }
+
+    free(names);
+    free(sorted);
+
+    index->name_heads = malloc(sizeof(size_t) * (ndistinct + 1));
+    memset(index->name_heads, 0, sizeof(size_t) * (ndistinct + 1));
+    index->name_next = malloc(sizeof(size_t) * (n + 1));
+
+    /* backwards, so every name lists its nodes in preorder */
+    for (size_t i = n; i-- > 0; ) {
+        unsigned int id = index->nodes.nodes[i]->name_id;
+        index->name_next[i] = index->name_heads[id];
+        index->name_heads[id] = i + 1;
+    }
+
+    /* added on top of the paths, which still hold every name */
+    size_t bytes = index->names->bytes +
+        sizeof(size_t) * (ndistinct + 1) + sizeof(size_t) * (n + 1) +
+        sizeof(unsigned int) * index->name_nslots;
+    printf("[index] %ld names, %ld distinct, dictionary %ld bytes, "
+        "name tables %.1f bytes/node\n", n, ndistinct, index->names->bytes,
+        n ? (double)bytes / n : 0.0);
+}
+
+index_t
+index_new(size_t size, const char *dir, size_t strip, int examine,
+    const crawl_opts_t *opts)
+{
+    index_t index = malloc(sizeof(struct index_s));
+    memset(index, 0, sizeof(struct index_s));
+    atomic_init(&index->refs, 1);
+    index->strip = strip;
+
+    if (examine) {
+        index->magic = magic_open(MAGIC_MIME);
+        if (index->magic && magic_load(index->magic, NULL) < 0) {
+            magic_close(index->magic);
+            index->magic = NULL;
         }
+        if (!index->magic)
+            fprintf(stderr, "[index] error opening magic, not examining\n");
+    }
+
+    index->crawl = crawl_new(opts);
+
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    summary_t summary = { 0 };
+    index->root = index_recurse(index, size, dir, &summary);
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+    double elapsed = (finish.tv_sec - start.tv_sec) +
+        0.000000001 * (finish.tv_nsec - start.tv_nsec);
+    printf("[index] crawled %s: %ld entries in %.3f s, %.0f entries/s (%s)\n",
+        dir, index->nodes.size, elapsed,
+        elapsed > 0 ? index->nodes.size / elapsed : 0.0,
+        crawl_backend(index->crawl));
+
+    crawl_destroy(index->crawl);
+    index->crawl = NULL;
+
+    if (index->magic) {
+        magic_close(index->magic);
+        index->magic = NULL;
     }
+
+    if (!index->root) {
+        index_unref(index);
+        return NULL;
+    }
+
+    index_dict_names(index);
+    return index;
+}
+
+size_t
+index_size(index_t index)
+{
+    return index->nodes.size;
 }
 
 void
-index_lookup_substr_caseinsensitive(map_t *index, const char *query,
-    results_t *results)
+index_ref(index_t index)
 {
-    for (size_t i = 0; i < index->size; i++) {
-        if (!index->map[i].data)
+    atomic_fetch_add(&index->refs, 1);
+}
+
+void
+index_unref(index_t index)
+{
+    if (atomic_fetch_sub(&index->refs, 1) == 1)
+        index_destroy(index);
+}
+
+/* resolve a root relative directory path by walking the directory maps */
+static const node_data_t *
+index_resolve_dir(index_t index, const char *dir)
+{
+    char component[4096];
+    const node_data_t *data = NULL;
+    map_t *map = index->root;
+
+    while (*dir) {
+        size_t len = strcspn(dir, "/");
+        if (len == 0 || len >= sizeof(component)) {
+            dir += len + (dir[len] == '/');
             continue;
+        }
+        memcpy(component, dir, len);
+        component[len] = '\0';
+        dir += len + (dir[len] == '/');
 
-        for (struct node_s *node = &index->map[i]; node; node = node->next) {
-            if (strcasestr(node->data->name, query))
-                results_insert(results, node->data);
-            if (node->child)
-                index_lookup_substr_caseinsensitive(node->child, query, results);
+        if (!map)
+            return NULL;
+
+        struct node_s *node = &map->map[hash(component, map->size)];
+        for (; node && node->data; node = node->next)
+            if (strcmp(node->data->name, component) == 0)
+                break;
+        if (!node || !node->data || !S_ISDIR(node->data->stat.st_mode))
+            return NULL;
+
+        data = node->data;
+        map = node->child;
+    }
+
+    return data;
+}
+
+/* node range to scan, the descendants of dir or the whole index */
+static int
+index_scope(index_t index, const char *dir, size_t *begin, size_t *end)
+{
+    *begin = 0;
+    *end = index->nodes.size;
+
+    if (!dir || !*dir)
+        return 0;
+
+    const node_data_t *data = index_resolve_dir(index, dir);
+    if (!data)
+        return -1;
+
+    *begin = data->id + 1;
+    *end = data->end;
+    return 0;
+}
+
+/* form filters, checked in the matching pass so facets count once */
+static inline int
+filter_match(const filter_t *filter, const node_data_t *n)
+{
+    if (!filter)
+        return 1;
+    if (filter->time_low && n->stat.st_mtime < filter->time_low)
+        return 0;
+    if (filter->time_high && n->stat.st_mtime > filter->time_high)
+        return 0;
+    if (filter->size_low && (size_t)n->stat.st_size < filter->size_low)
+        return 0;
+    if (filter->size_high && (size_t)n->stat.st_size > filter->size_high)
+        return 0;
+    return 1;
+}
+
+/* the clock is only read every DEADLINE_CHECK_NODES nodes */
+static int
+index_deadline(deadline_t *deadline, size_t *scanned, results_t *results)
+{
+    if (!deadline || ++*scanned % DEADLINE_CHECK_NODES)
+        return 0;
+    if (!deadline_check(deadline))
+        return 0;
+    results->partial = 1;
+    return 1;
+}
+
+/* bit per name id, for the names that contain query, out of time only the
+ * first *nnames are set */
+static uint8_t *
+index_match_names(index_t index, const char *query, int nocase,
+    results_t *results, deadline_t *deadline, size_t *nnames)
+{
+    size_t size = (index->names->size + 7) / 8;
+    uint8_t *matches = results_alloc(results, size);
+    memset(matches, 0, size);
+
+    dict_iter_t iter;
+    dict_iter_init(&iter, index->names);
+    size_t scanned = 0;
+    for (const char *name; (name = dict_next(&iter)); ) {
+        if (index_deadline(deadline, &scanned, results))
+            break;
+        if (nocase ? strcasestr(name, query) : strstr(name, query))
+            matches[iter.id / 8] |= 1 << iter.id % 8;
+    }
+    *nnames = results->partial ? iter.id : index->names->size;
+    dict_iter_free(&iter);
+    return matches;
+}
+
+/* nodes in range with name id, by the chain of that name */
+static int
+index_insert_name(index_t index, size_t id, size_t begin, size_t end,
+    const filter_t *filter, results_t *results, deadline_t *deadline,
+    size_t *scanned)
+{
+    const node_data_t **nodes = index->nodes.nodes;
+    for (size_t i = index->name_heads[id]; i; i = index->name_next[i - 1])
+    {
+        if (index_deadline(deadline, scanned, results))
+            return -1;
+        const node_data_t *data = nodes[i - 1];
+        if (data->id >= begin && data->id < end && filter_match(filter, data))
+            results_insert(results, data);
+    }
+    return 0;
+}
+
+/*
+ * Kernels scan a node range, a directory whose summary rules out the query
+ * has its own name checked and its whole subtree skipped. Out of time they
+ * stop with the results found so far. A range with many more nodes than
+ * there are distinct names matches each name once, streaming the dictionary,
+ * and then only tests the bit of each node's name.
+ */
+static void
+index_lookup_names(index_t index, size_t begin, size_t end,
+    const char *query, int nocase, const filter_t *filter, results_t *results,
+    deadline_t *deadline)
+{
+    summary_t qsummary = { 0 };
+    summary_add(&qsummary, query);
+
+    uint8_t *matches = NULL;
+    if (end - begin >= DICT_SCAN_RATIO * index->names->size) {
+        size_t nnames = 0;
+        matches = index_match_names(index, query, nocase, results, deadline,
+            &nnames);
+
+        /* out of time among the names, the nodes of those that matched */
+        if (results->partial) {
+            size_t scanned = 0;
+            for (size_t id = 0; id < nnames; id++)
+                if (matches[id / 8] & 1 << id % 8)
+                    index_insert_name(index, id, begin, end, filter, results,
+                        NULL, &scanned);
+            results_free(results, matches);
+            return;
         }
     }
+
+    const node_data_t **nodes = index->nodes.nodes;
+    size_t scanned = 0;
+    for (size_t i = begin; i < end; i++) {
+        if (index_deadline(deadline, &scanned, results))
+            break;
+        unsigned int id = nodes[i]->name_id;
+        if ((matches ? matches[id / 8] & 1 << id % 8 :
+            nocase ? strcasestr(nodes[i]->name, query) != NULL :
+            strstr(nodes[i]->name, query) != NULL) &&
+            filter_match(filter, nodes[i]))
+            results_insert(results, nodes[i]);
+        if (nodes[i]->summary && !summary_covers(nodes[i]->summary, &qsummary))
+            i = nodes[i]->end - 1;
+    }
+
+    results_free(results, matches);
 }
 
 void
-index_lookup_exact(map_t *index, const char *query, results_t *results)
+index_lookup_substr(index_t index, size_t begin, size_t end,
+    const char *query, const filter_t *filter, results_t *results,
+    deadline_t *deadline)
 {
-    for (size_t i = 0; i < index->size; i++) {
-        if (!index->map[i].data)
-            continue;
+    index_lookup_names(index, begin, end, query, 0, filter, results,
+        deadline);
+}
 
-        for (struct node_s *node = &index->map[i]; node; node = node->next) {
-            if (strcmp(node->data->name, query) == 0)
-                results_insert(results, node->data);
-            if (node->child)
-                index_lookup_exact(node->child, query, results);
-        }
+void
+index_lookup_substr_caseinsensitive(index_t index, size_t begin, size_t end,
+    const char *query, const filter_t *filter, results_t *results,
+    deadline_t *deadline)
+{
+    index_lookup_names(index, begin, end, query, 1, filter, results,
+        deadline);
+}
+
+/* id of a name, -1 if no node has it */
+static long
+index_name_id(index_t index, const char *name)
+{
+    const node_data_t **nodes = index->nodes.nodes;
+    for (size_t slot = hash(name, index->name_nslots);
+        index->name_slots[slot]; slot = (slot + 1) % index->name_nslots)
+    {
+        unsigned int id = index->name_slots[slot] - 1;
+        if (strcmp(nodes[index->name_heads[id] - 1]->name, name) == 0)
+            return id;
     }
+    return -1;
 }
 
+/* a probe of the name hash, the subtree is an id range check */
 void
-index_lookup_regex(map_t *index, const char *query,
-    results_t *results)
+index_lookup_exact(index_t index, size_t begin, size_t end,
+    const char *query, const filter_t *filter, results_t *results,
+    deadline_t *deadline)
 {
+    long id = index_name_id(index, query);
+    if (id < 0)
+        return;
 
+    size_t scanned = 0;
+    index_insert_name(index, id, begin, end, filter, results, deadline,
+        &scanned);
+}
+
+void
+index_lookup_regex(index_t index, size_t begin, size_t end,
+    const char *query, const filter_t *filter, results_t *results,
+    deadline_t *deadline)
+{
+
+}
+
+/* name needles every match must contain */
+static void
+index_query_summary(const query_t *query, summary_t *summary)
+{
+    if (query->op == QUERY_AND) {
+        for (size_t i = 0; i < query->nsub; i++)
+            index_query_summary(query->sub[i], summary);
+    }
+    else if ((query->op == QUERY_NAME || query->op == QUERY_INAME) &&
+        (query->cmp == CMP_CONTAINS || query->cmp == CMP_EQ))
+        summary_add(summary, query->str);
+}
+
+void
+index_lookup_structured(index_t index, size_t begin, size_t end,
+    const query_t *query, results_t *results, deadline_t *deadline)
+{
+    summary_t qsummary = { 0 };
+    index_query_summary(query, &qsummary);
+
+    const node_data_t **nodes = index->nodes.nodes;
+    size_t scanned = 0;
+    for (size_t i = begin; i < end; i++) {
+        if (index_deadline(deadline, &scanned, results))
+            break;
+        if (query_match(query, nodes[i]))
+            results_insert(results, nodes[i]);
+        if (nodes[i]->summary && !summary_covers(nodes[i]->summary, &qsummary))
+            i = nodes[i]->end - 1;
+    }
+}
+
+/* most selective positive ext: predicate, its nodes are the candidates */
+static const query_t *
+index_query_ext_driver(index_t index, const query_t *query)
+{
+    if (query->op == QUERY_EXT)
+        return query;
+    if (query->op != QUERY_AND)
+        return NULL;
+
+    const query_t *driver = NULL;
+    size_t driver_size = 0;
+    for (size_t i = 0; i < query->nsub; i++) {
+        const query_t *q = query->sub[i];
+        if (q->op != QUERY_EXT)
+            continue;
+        size_t size = q->num > 0 && q->num < index->ext_nodes_size ?
+            index->ext_nodes[q->num].size : 0;
+        if (!driver || size < driver_size) {
+            driver = q;
+            driver_size = size;
+        }
+    }
+    return driver;
 }
 
 results_t *
-index_lookup(map_t *index, lookup_type_t type, const char *query)
+index_lookup_query(index_t index, const query_t *query, const char *dir,
+    arena_t *arena, deadline_t *deadline)
 {
-    results_t *results = results_new();
+    results_t *results = results_new(arena);
+
+    size_t begin, end;
+    if (index_scope(index, dir, &begin, &end) < 0)
+        return results;
+
+    results_hold(results, index);
+
+    /* the ext: posting list when it is shorter than the scanned range */
+    const query_t *ext = index_query_ext_driver(index, query);
+    if (!ext) {
+        index_lookup_structured(index, begin, end, query, results,
+            deadline);
+        return results;
+    }
+
+    if (ext->num <= 0 || ext->num >= index->ext_nodes_size)
+        return results;
+
+    const nodevec_t *vec = &index->ext_nodes[ext->num];
+    if (vec->size > end - begin) {
+        index_lookup_structured(index, begin, end, query, results,
+            deadline);
+        return results;
+    }
+
+    size_t scanned = 0;
+    for (size_t i = 0; i < vec->size; i++) {
+        if (index_deadline(deadline, &scanned, results))
+            break;
+        if (vec->nodes[i]->id >= begin && vec->nodes[i]->id < end &&
+            query_match(query, vec->nodes[i]))
+            results_insert(results, vec->nodes[i]);
+    }
+
+    return results;
+}
+
+results_t *
+index_lookup(index_t index, lookup_type_t type, const char *query,
+    const char *dir, const filter_t *filter, arena_t *arena,
+    deadline_t *deadline)
+{
+    results_t *results = results_new(arena);
+
+    size_t begin, end;
+    if (index_scope(index, dir, &begin, &end) < 0)
+        return results;
+
+    results_hold(results, index);
 
     switch (type) {
     case LOOKUP_SUBSTR:
-        index_lookup_substr(index, query, results);
+        index_lookup_substr(index, begin, end, query, filter, results,
+            deadline);
     break;
     case LOOKUP_SUBSTR_CASEINSENSITIVE:
-        index_lookup_substr_caseinsensitive(index, query, results);
+        index_lookup_substr_caseinsensitive(index, begin, end, query, filter,
+            results, deadline);
     break;
     case LOOKUP_EXACT:
-        index_lookup_exact(index, query, results);
+        index_lookup_exact(index, begin, end, query, filter, results,
+            deadline);
     break;
     case LOOKUP_REGEX:
-        index_lookup_regex(index, query, results);
+        index_lookup_regex(index, begin, end, query, filter, results,
+            deadline);
     break;
+    case LOOKUP_QUERY:
+        /* parsed and planned once by the caller, see index_lookup_query() */
+    break;
+    }
+
+    return results;
+}
+
+/*
+ * Batch of exact, substring and case insensitive substring patterns. The
+ * substring ones are compiled into two automata so that a single pass over
+ * the names answers all of them.
+ */
+batch_t *
+batch_new(const lookup_type_t *types, const char **patterns, size_t n,
+    arena_t *arena)
+{
+    batch_t *batch = arena_calloc(arena, sizeof(batch_t));
+    batch->n = n;
+    batch->types = types;
+    batch->patterns = patterns;
+
+    const char **substr = arena_alloc(arena, sizeof(char*) * n);
+    const char **nocase = arena_alloc(arena, sizeof(char*) * n);
+    batch->substr_ids = arena_alloc(arena, sizeof(size_t) * n);
+    batch->nocase_ids = arena_alloc(arena, sizeof(size_t) * n);
+
+    size_t nsubstr = 0, nnocase = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (types[i] == LOOKUP_SUBSTR) {
+            batch->substr_ids[nsubstr] = i;
+            substr[nsubstr++] = patterns[i];
+        } else if (types[i] == LOOKUP_SUBSTR_CASEINSENSITIVE) {
+            batch->nocase_ids[nnocase] = i;
+            nocase[nnocase++] = patterns[i];
+        }
+    }
+
+    if (nsubstr)
+        batch->substr = acm_new(substr, nsubstr, 0, arena);
+    if (nnocase)
+        batch->nocase = acm_new(nocase, nnocase, 1, arena);
+    return batch;
+}
+
+typedef struct {
+    results_t **results;
+    const size_t *ids;          /* automaton pattern to batch index */
+    size_t *last;               /* last node inserted, per batch index */
+    const node_data_t *data;
+} batch_scan_t;
+
+static void
+batch_hit(size_t pattern, void *arg)
+{
+    batch_scan_t *scan = arg;
+    size_t i = scan->ids[pattern];
+
+    /* once per name however many times it occurs */
+    if (scan->last[i] == scan->data->id + 1)
+        return;
+    scan->last[i] = scan->data->id + 1;
+    results_insert(scan->results[i], scan->data);
+}
+
+/* one results per pattern, in batch order */
+results_t **
+index_lookup_batch(index_t index, const batch_t *batch, arena_t *arena,
+    deadline_t *deadline)
+{
+    results_t **results = arena_alloc(arena, sizeof(results_t*) * batch->n);
+    for (size_t i = 0; i < batch->n; i++) {
+        results[i] = results_new_hits(arena);
+        results_hold(results[i], index);
+    }
+
+    for (size_t i = 0; i < batch->n; i++)
+        if (batch->types[i] == LOOKUP_EXACT)
+            index_lookup_exact(index, 0, index->nodes.size,
+                batch->patterns[i], NULL, results[i], deadline);
+
+    if (!batch->substr && !batch->nocase)
+        return results;
+
+    size_t *last = arena_calloc(arena, sizeof(size_t) * batch->n);
+    batch_scan_t substr = { results, batch->substr_ids, last, NULL };
+    batch_scan_t nocase = { results, batch->nocase_ids, last, NULL };
+
+    const node_data_t **nodes = index->nodes.nodes;
+    size_t scanned = 0;
+    for (size_t i = 0; i < index->nodes.size; i++) {
+        if (deadline && ++scanned % DEADLINE_CHECK_NODES == 0 &&
+            deadline_check(deadline))
+        {
+            for (size_t j = 0; j < batch->n; j++)
+                results[j]->partial = 1;
+            break;
+        }
+
+        substr.data = nocase.data = nodes[i];
+        if (batch->substr)
+            acm_run(batch->substr, nodes[i]->name, batch_hit, &substr);
+        if (batch->nocase)
+            acm_run(batch->nocase, nodes[i]->name, batch_hit, &nocase);
     }
 
     return results;
 }
 
+static void
+map_destroy(map_t *map)
+{
+    for (size_t i = 0; i < map->size; i++) {
+        struct node_s *node = &map->map[i];
+        if (node->child)
+            map_destroy(node->child);
+        for (struct node_s *next = node->next; next; ) {
+            node = next;
+            next = node->next;
+            if (node->child)
+                map_destroy(node->child);
+            free(node);
+        }
+    }
+    free(map->map);
+    free(map);
+}
+
 void
 index_destroy(index_t index)
 {
+    if (index->root)
+        map_destroy(index->root);
+
+    for (size_t i = 0; i < index->nodes.size; i++) {
+        node_data_t *data = (node_data_t*)index->nodes.nodes[i];
+        free((char*)data->path);
+        free(data->summary);
+        free(data);
+    }
+    free(index->nodes.nodes);
+
+    for (size_t i = 0; i < index->ext_nodes_size; i++)
+        free(index->ext_nodes[i].nodes);
+    free(index->ext_nodes);
+    dict_destroy(index->names);
+    free(index->name_heads);
+    free(index->name_next);
+    free(index->name_slots);
 
+    free(index);
 }
 
 
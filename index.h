@@ -26,20 +26,29 @@
 #include <sys/stat.h>
 #include <stddef.h>
 
+#include "arena.h"
+#include "deadline.h"
+#include "crawl.h"
+
 typedef enum {
     LOOKUP_SUBSTR,
     LOOKUP_SUBSTR_CASEINSENSITIVE,
     LOOKUP_EXACT,
-    LOOKUP_REGEX
+    LOOKUP_REGEX,
+    LOOKUP_QUERY
 } lookup_type_t;
 
 typedef struct {
-    const char *name, *path;
+    const char *name, *path;        /* name points into path */
     struct stat stat;
     const char *mime;
+    unsigned int ext_id, mime_id;   /* interned, 0 for none */
+    unsigned int name_id;           /* in the index name dictionary */
+    size_t id, end;                 /* DFS position, end of its subtree */
+    struct summary_s *summary;      /* directories, names below them */
 } node_data_t;
 
-typedef struct map_s *index_t;
+typedef struct index_s *index_t;
 
 typedef enum {
     SORT_NAME,
@@ -54,19 +63,59 @@ typedef struct {
     size_t size_low, size_high;
 } filter_t;
 
+typedef enum {
+    FACET_EXT,
+    FACET_MIME,
+    FACET_MAX
+} facet_type_t;
+
+typedef struct {
+    const char *value;
+    size_t count;
+} facet_t;
+
 typedef struct {
     const node_data_t **results;
     size_t size, capacity;
+    size_t *facets[FACET_MAX];  /* match count by interned id */
+    size_t nfacets[FACET_MAX];
+    index_t *indexes;           /* referenced while results point into them */
+    size_t nindexes;
+    arena_t *arena;             /* backing memory, NULL for the heap */
+    int partial;                /* lookup stopped by its deadline */
 } results_t;
 
+struct query_s;
+
+/* many patterns looked up together, see batch_new() */
+typedef struct batch_s batch_t;
+
 int index_init();
 void index_deinit();
-index_t index_new(size_t icapacity, const char *root, int examine);
-results_t *index_lookup(index_t index, lookup_type_t type, const char *query);
+index_t index_new(size_t icapacity, const char *root, size_t strip,
+    int examine, const crawl_opts_t *opts);
+size_t index_size(index_t index);
+results_t *index_lookup(index_t index, lookup_type_t type, const char *query,
+    const char *dir, const filter_t *filter, arena_t *arena,
+    deadline_t *deadline);
+results_t *index_lookup_query(index_t index, const struct query_s *query,
+    const char *dir, arena_t *arena, deadline_t *deadline);
+results_t **index_lookup_batch(index_t index, const batch_t *batch,
+    arena_t *arena, deadline_t *deadline);
+unsigned int index_ext_id(const char *ext);
+void index_ref(index_t index);
+void index_unref(index_t index);
 void index_destroy(index_t index);
 
+batch_t *batch_new(const lookup_type_t *types, const char **patterns,
+    size_t n, arena_t *arena);
+
 void results_sort(results_t *results, sort_type_t sort_type, int desc);
-results_t *results_filter(results_t *results, const filter_t *filter);
+results_t *results_merge(results_t **parts, size_t n, sort_type_t sort_type,
+    int desc, arena_t *arena);
+results_t *results_copy(const results_t *results, arena_t *arena);
+size_t results_facets(const results_t *results, facet_type_t type,
+    facet_t *top, size_t n);
 void results_destroy(results_t *results);
 
 #endif /* _INDEX_H */
@@ -31,20 +31,71 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <microhttpd.h>
 
 #include "config.h"
+#include "accesslog.h"
+#include "arena.h"
+#include "deadline.h"
 #include "index.h"
-
-static char *index_format_template = NULL;
-
-static index_t g_index = NULL;
+#include "query.h"
+#include "shard.h"
+#include "template.h"
+
+/* index template slots */
+enum {
+    SLOT_QUERY,
+    SLOT_TYPE_SUBSTR,
+    SLOT_TYPE_NOCASE,
+    SLOT_TYPE_EXACT,
+    SLOT_TYPE_REGEX,
+    SLOT_TYPE_QUERY,
+    SLOT_TIME_LOW,
+    SLOT_TIME_HIGH,
+    SLOT_SIZE_LOW,
+    SLOT_SIZE_HIGH,
+    SLOT_DIR,
+    SLOT_HEADER,
+    SLOT_RESULTS,
+    SLOT_MAX
+};
+
+static const char *slot_names[SLOT_MAX] = {
+    "query", "type_substr", "type_nocase", "type_exact", "type_regex",
+    "type_query", "time_low", "time_high", "size_low", "size_high", "dir",
+    "header", "results"
+};
+
+static tmpl_t *index_template = NULL;
+
+/* landing page never changes, rendered once */
+static out_t landing_page, landing_page_gzip;
+static char landing_etag[32];
+
+/* state across the calls for one request, released in request_completed() */
+typedef struct {
+    arena_t *arena;
+    struct timespec start;      /* CLOCK_MONOTONIC, for the access log */
+    out_t body;                 /* POST upload */
+    int too_large;
+} request_t;
+
+typedef struct {
+    const results_t *results;
+    const char *baseurl;
+    sort_type_t sort_type;
+    int sort_order;
+    float lookup_time;
+    const shard_result_t *stats;
+    size_t nstats;
+} results_page_t;
 
 static const char *result_html_header = 
-    "<p>%ld results in %f seconds</p>\n"
     "<div class=\"result-header\">\n"
         "<a class=\"sort-name %s\" href=\"%s\">Name %s</a><a class=\"mime %s\" href=\"%s\">mime-type %s</a><br>\n"
         "<a class=\"path %s\" href=\"%s\">path %s</a><div class=\"attrib\">"
@@ -55,35 +106,88 @@ static const char *result_html_header =
 static const char *result_html_template = 
     "<div class=\"result\">\n"
         "<span class=\"name\">%s</span><super class=\"mime\">%s</super><br>\n"
-        "<a class=\"path\" href=\"%s\">%s</a><div class=\"attrib\">"
+        "<a class=\"path\" href=\"%s%s\">%s</a><div class=\"attrib\">"
             "<span class=\"size\">%s</span>"
             "<span class=\"time\">%s</span></div><br>\n"
     "</div>\n";
 
-static const char *
-generate_results_header_html(struct MHD_Connection *connection, const char *baseurl,
-    sort_type_t sort_type, int sort_order, size_t nresults, float lookup_time)
+static void
+generate_facets_html(out_t *out, const results_t *results)
 {
-    static char buff[65535], name_url[256], mime_url[256], path_url[256],
-        size_url[256], time_url[256];
-
-    *buff = '\0';
-
-    const char *arrows[] = { "&#8593;", "&#8595;" };
+    facet_t top[FACET_TOP];
+    const char *titles[FACET_MAX] = { "extension", "mime-type" };
+
+    for (int type = 0; type < FACET_MAX; type++) {
+        size_t ntop = results_facets(results, type, top, FACET_TOP);
+        if (!ntop)
+            continue;
+
+        out_printf(out,
+            "<p class=\"facets\"><span class=\"facet-title\">%s</span>",
+            titles[type]);
+        for (size_t i = 0; i < ntop; i++)
+            out_printf(out, "<span class=\"facet\">%s (%ld)</span>",
+                html_escape(top[i].value, out->arena), top[i].count);
+        out_puts(out, "</p>\n");
+    }
+}
 
-    int name_order = (sort_type == SORT_NAME) && sort_order;
-    int mime_order = (sort_type == SORT_MIME) && sort_order;
-    int path_order = (sort_type == SORT_PATH) && sort_order;
-    int size_order = (sort_type == SORT_SIZE) && sort_order;
-    int time_order = (sort_type == SORT_TIME) && sort_order;
+static void
+generate_shards_html(out_t *out, const shard_result_t *stats, size_t nstats)
+{
+    if (nstats < 2)
+        return;
+
+    out_puts(out, "<p class=\"shards\">");
+    for (size_t i = 0; i < nstats; i++) {
+        if (stats[i].ready)
+            out_printf(out, "<span class=\"shard\">%s: %ld in %f s%s</span>",
+                html_escape(stats[i].name, out->arena), stats[i].nresults, stats[i].lookup_time,
+                stats[i].partial ? " (partial)" : "");
+        else
+            out_printf(out, "<span class=\"shard\">%s: indexing</span>",
+                html_escape(stats[i].name, out->arena));
+    }
+    out_puts(out, "</p>\n");
+}
 
-    snprintf(name_url, 256, "%s&s=n&o=%c", baseurl, name_order ? 'a' : 'd');
-    snprintf(mime_url, 256, "%s&s=m&o=%c", baseurl, mime_order ? 'a' : 'd');
-    snprintf(path_url, 256, "%s&s=p&o=%c", baseurl, path_order ? 'a' : 'd');
-    snprintf(size_url, 256, "%s&s=s&o=%c", baseurl, size_order ? 'a' : 'd');
-    snprintf(time_url, 256, "%s&s=t&o=%c", baseurl, time_order ? 'a' : 'd');
+static void
+generate_results_header_html(out_t *out, void *arg)
+{
+    const results_page_t *page = arg;
+    char name_url[8192], mime_url[8192], path_url[8192], size_url[8192],
+        time_url[8192];
 
-    snprintf(buff, 65535, result_html_header, nresults, lookup_time,
+    const char *arrows[] = { "&#8593;", "&#8595;" };
+    sort_type_t sort_type = page->sort_type;
+    const char *baseurl = html_escape(page->baseurl, out->arena);
+
+    int name_order = (sort_type == SORT_NAME) && page->sort_order;
+    int mime_order = (sort_type == SORT_MIME) && page->sort_order;
+    int path_order = (sort_type == SORT_PATH) && page->sort_order;
+    int size_order = (sort_type == SORT_SIZE) && page->sort_order;
+    int time_order = (sort_type == SORT_TIME) && page->sort_order;
+
+    snprintf(name_url, 8192, "%s&s=n&o=%c", baseurl,
+        name_order ? 'a' : 'd');
+    snprintf(mime_url, 8192, "%s&s=m&o=%c", baseurl,
+        mime_order ? 'a' : 'd');
+    snprintf(path_url, 8192, "%s&s=p&o=%c", baseurl,
+        path_order ? 'a' : 'd');
+    snprintf(size_url, 8192, "%s&s=s&o=%c", baseurl,
+        size_order ? 'a' : 'd');
+    snprintf(time_url, 8192, "%s&s=t&o=%c", baseurl,
+        time_order ? 'a' : 'd');
+
+    out_printf(out, "<p>%ld results in %f seconds</p>\n", page->results->size,
+        page->lookup_time);
+    if (page->results->partial)
+        out_puts(out, "<p class=\"partial\">partial results, the query ran "
+            "out of time</p>\n");
+    generate_facets_html(out, page->results);
+    generate_shards_html(out, page->stats, page->nstats);
+
+    out_printf(out, result_html_header,
         sort_type == SORT_NAME ? "sort-active" : "", name_url,
             arrows[!name_order],
         sort_type == SORT_MIME ? "sort-active" : "", mime_url,
@@ -95,14 +199,11 @@ generate_results_header_html(struct MHD_Connection *connection, const char *base
         sort_type == SORT_TIME ? "sort-active" : "", time_url,
             arrows[!time_order]
     );
-
-    return buff;
 }
 
 static const char *
-sizestr(size_t size)
+sizestr(size_t size, char *buf)
 {
-    static char buf[32];
     if (size < 1024)
         snprintf(buf, 32, "%ld B", size);
     else if (size < 1024LL * 1024LL)
@@ -111,45 +212,157 @@ sizestr(size_t size)
         snprintf(buf, 32, "%.2f MiB", (float)size/(1024.f*1024.f));
     else if (size < 1024LL * 1024LL * 1024LL * 1024LL)
         snprintf(buf, 32, "%.2f GiB", (float)size/(1024.f*1024.f*1024.f));
-    else if (size < 1024LL * 1024LL * 1024LL * 1024LL * 1024LL)
+    else
         snprintf(buf, 32, "%.2f TiB", (float)size/(1024.f*1024.f*1024.f*1024.f));
     return buf;
 }
 
-static char *
-generate_results_html(results_t *results)
+static void
+generate_results_html(out_t *out, void *arg)
 {
-    static char timebuf[256], urlbuf[4096];
-    
-    char *buff = malloc(1024 * results->size); /* alloc 1K per result */
-    char *pos = buff;
-
-    *pos = '\0';
+    const results_page_t *page = arg;
+    char timebuf[256], sizebuf[32];
+    struct tm tm_mtim;
   
-    for (int i = 0; i < results->size; i++) {
-        const node_data_t *data = results->results[i];
-        struct tm *tm_mtim = gmtime(&data->stat.st_mtime);
-        strftime(timebuf, 256, "%b %d %Y", tm_mtim);
-
-        snprintf(urlbuf, 4096, "%s%s", result_subdir, data->path);
-
-        pos += snprintf(pos, 1024,
+    for (size_t i = 0; i < page->results->size; i++) {
+        const node_data_t *data = page->results->results[i];
+        gmtime_r(&data->stat.st_mtime, &tm_mtim);
+        strftime(timebuf, 256, "%b %d %Y", &tm_mtim);
+
+        /* names are whatever the filesystem holds */
+        const char *path = html_escape(data->path, out->arena);
+        out_printf(out,
             result_html_template,
-            data->name,
-            data->mime ? data->mime : "",
-            urlbuf, data->path,
-            sizestr(data->stat.st_size), timebuf
+            html_escape(data->name, out->arena),
+            data->mime ? html_escape(data->mime, out->arena) : "",
+            result_subdir, path, path,
+            sizestr(data->stat.st_size, sizebuf), timebuf
         );
     }
+}
+
+/* q value of coding in an Accept-Encoding list, -1 if not listed */
+static double
+encoding_q(const char *list, const char *coding)
+{
+    size_t len = strlen(coding);
+    for (const char *c = list; *c; ) {
+        c += strspn(c, " \t,");
+        size_t n = strcspn(c, " \t;,");
+        int match = n == len && strncasecmp(c, coding, len) == 0;
+        c += n;
+
+        /* parameters up to the next coding */
+        double q = 1.0;
+        while (*c && *c != ',') {
+            c += strspn(c, " \t;");
+            if ((c[0] == 'q' || c[0] == 'Q') && c[1] == '=')
+                q = strtod(c + 2, NULL);
+            c += strcspn(c, ";,");
+        }
+        if (match)
+            return q;
+    }
+    return -1;
+}
 
-    return buff;
+/* gzip;q=0 refuses gzip, * covers it when it is not listed */
+static int
+accepts_gzip(struct MHD_Connection *connection)
+{
+    const char *encoding = MHD_lookup_connection_value(connection,
+        MHD_HEADER_KIND, "Accept-Encoding");
+    if (!encoding)
+        return 0;
+
+    double q = encoding_q(encoding, "gzip");
+    if (q < 0)
+        q = encoding_q(encoding, "*");
+    return q > 0;
 }
 
-const char *
-subdir_endpoint(const char *endpoint) {
-    static char subdir_endpoint[256];
-    snprintf(subdir_endpoint, 256, "%s%s", app_subdir, endpoint);
-    return subdir_endpoint;
+static void
+render_landing_page(void)
+{
+    tmpl_value_t values[SLOT_MAX] = { 0 };
+    values[SLOT_TYPE_SUBSTR].str = "checked=\"checked\"";
+
+    out_init(&landing_page, 0, 0, NULL);
+    tmpl_render(index_template, values, &landing_page);
+    out_finish(&landing_page);
+
+    out_init(&landing_page_gzip, 1, Z_BEST_COMPRESSION, NULL);
+    tmpl_render(index_template, values, &landing_page_gzip);
+    out_finish(&landing_page_gzip);
+
+    /* fnv-1a of the page, same for both encodings */
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < landing_page.size; i++)
+        hash = (hash ^ (unsigned char)landing_page.buff[i]) * 1099511628211ULL;
+    snprintf(landing_etag, sizeof(landing_etag), "W/\"%016llx\"", hash);
+}
+
+/* If-None-Match lists the etag (weak comparison) or is * */
+static int
+etag_match(struct MHD_Connection *connection, const char *etag)
+{
+    const char *header = MHD_lookup_connection_value(connection,
+        MHD_HEADER_KIND, "If-None-Match");
+    if (!header || !*etag)
+        return 0;
+
+    const char *tag = strncmp(etag, "W/", 2) == 0 ? etag + 2 : etag;
+    size_t len = strlen(tag);
+
+    for (const char *c = header; *c; ) {
+        while (*c == ' ' || *c == '\t' || *c == ',')
+            c++;
+        if (*c == '*')
+            return 1;
+        if (strncmp(c, "W/", 2) == 0)
+            c += 2;
+        if (strncmp(c, tag, len) == 0 &&
+            (c[len] == '\0' || c[len] == ',' || c[len] == ' ' ||
+             c[len] == '\t'))
+            return 1;
+        while (*c && *c != ',')
+            c++;
+    }
+    return 0;
+}
+
+/* the page did not change, headers only */
+static enum MHD_Result
+queue_not_modified(struct MHD_Connection *connection, const char *etag)
+{
+    struct MHD_Response *response = MHD_create_response_from_buffer(0,
+        (void*)NULL, MHD_RESPMEM_PERSISTENT);
+    MHD_add_response_header(response, "ETag", etag);
+    MHD_add_response_header(response, "Cache-Control", "public, no-cache");
+    MHD_add_response_header(response, "Vary", "Accept-Encoding");
+    enum MHD_Result ret = MHD_queue_response(connection,
+        MHD_HTTP_NOT_MODIFIED, response);
+    MHD_destroy_response(response);
+    return ret;
+}
+
+/* seconds since the request arrived */
+static double
+request_latency(const request_t *request)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - request->start.tv_sec) +
+        0.000000001 * (now.tv_nsec - request->start.tv_nsec);
+}
+
+/* url is app_subdir followed by endpoint */
+static int
+is_endpoint(const char *url, const char *endpoint)
+{
+    size_t len = strlen(app_subdir);
+    return strncmp(url, app_subdir, len) == 0 &&
+        strcmp(url + len, endpoint) == 0;
 }
 
 enum MHD_Result answer_to_connection(
@@ -161,37 +374,67 @@ enum MHD_Result answer_to_connection(
     size_t *upload_data_size,
     void **ptr
 ) {
+    /* first call, a POST body follows in the next ones */
+    request_t *request = *ptr;
+    if (!request) {
+        arena_t *arena = arena_get();
+        request = arena_calloc(arena, sizeof(request_t));
+        request->arena = arena;
+        clock_gettime(CLOCK_MONOTONIC, &request->start);
+        out_init(&request->body, 0, 0, arena);
+        *ptr = request;
+        if (strcmp(method, "POST") == 0)
+            return MHD_YES;
+    }
+
+    if (*upload_data_size) {
+        if (request->body.size + *upload_data_size > BATCH_MAX_SIZE)
+            request->too_large = 1;
+        else
+            out_write(&request->body, upload_data, *upload_data_size);
+        *upload_data_size = 0;
+        return MHD_YES;
+    }
+
     const struct sockaddr_in **coninfo =
         (const struct sockaddr_in**)MHD_get_connection_info(
             connection, MHD_CONNECTION_INFO_CLIENT_ADDRESS);
 
-    time_t time_now = time(NULL);
-    struct tm *tm_now = gmtime(&time_now);
-    static char timestr[256];
-    strftime(timestr, 256, "%Y-%m-%d %H:%M:%S", tm_now);
-
-    printf("[%s] [webserver] %s %s %s: ",
-        timestr, inet_ntoa((*coninfo)->sin_addr), method, url);
+    /* handlers run on several threads, nothing static */
+    char addrstr[INET_ADDRSTRLEN], note[64] = "";
+    long nresults = -1;
+    size_t bytes = 0;
+    inet_ntop(AF_INET, &(*coninfo)->sin_addr, addrstr, sizeof(addrstr));
 
     struct MHD_Response *response;
-    int ret;
+    int ret, status;
 
-    if (strcmp(method, "GET") == 0 && strcmp(url, subdir_endpoint("/")) == 0) {
-        char resp_buff[4096];
-        snprintf(resp_buff, 16384, index_format_template, "",
-            "checked=\"checked\"", "", "", "", "", "", "", "", "", "");
+    if (strcmp(method, "GET") == 0 && is_endpoint(url, "/") &&
+        etag_match(connection, landing_etag))
+    {
+        status = MHD_HTTP_NOT_MODIFIED;
+        ret = queue_not_modified(connection, landing_etag);
+    }
+    else if (strcmp(method, "GET") == 0 && is_endpoint(url, "/")) {
+        int gzip = accepts_gzip(connection);
+        out_t *page = gzip ? &landing_page_gzip : &landing_page;
 
-        response = MHD_create_response_from_buffer(strlen(resp_buff),
-            (void*)resp_buff, MHD_RESPMEM_PERSISTENT);
+        response = MHD_create_response_from_buffer(page->size,
+            (void*)page->buff, MHD_RESPMEM_PERSISTENT);
 
         MHD_add_response_header(response, "Content-Type", "text/html");
-
-        printf("%d\n", 200);
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+        MHD_add_response_header(response, "ETag", landing_etag);
+        MHD_add_response_header(response, "Cache-Control", "public, no-cache");
+        if (gzip)
+            MHD_add_response_header(response, "Content-Encoding", "gzip");
+
+        bytes = page->size;
+        status = MHD_HTTP_OK;
+        ret = MHD_queue_response(connection, status, response);
         MHD_destroy_response(response);
     }
-    else if (strcmp(method, "GET") == 0 && strcmp(url,
-        subdir_endpoint("/query")) == 0)
+    else if (strcmp(method, "GET") == 0 && is_endpoint(url, "/query"))
     {
         /* get query */
         const char *query = MHD_lookup_connection_value(connection,
@@ -210,6 +453,7 @@ enum MHD_Result answer_to_connection(
             case 'i': query_type = LOOKUP_SUBSTR_CASEINSENSITIVE; break;
             case 'e': query_type = LOOKUP_EXACT; break;
             case 'r': query_type = LOOKUP_REGEX; break;
+            case 'q': query_type = LOOKUP_QUERY; break;
             }
         } else query_type = LOOKUP_SUBSTR;
 
@@ -242,33 +486,51 @@ enum MHD_Result answer_to_connection(
         const char *filter_size_high = MHD_lookup_connection_value(connection,
             MHD_GET_ARGUMENT_KIND, "fsh");
 
+        /* get subtree scope */
+        const char *dir = MHD_lookup_connection_value(connection,
+            MHD_GET_ARGUMENT_KIND, "dir");
+
+        /* time budget, a request may only lower the configured one */
+        const char *time_limit_str = MHD_lookup_connection_value(connection,
+            MHD_GET_ARGUMENT_KIND, "tl");
+        long budget = timeout;
+        long time_limit = time_limit_str ? atol(time_limit_str) : 0;
+        if (time_limit > 0 && (budget <= 0 || time_limit < budget))
+            budget = time_limit;
+
         filter_t filter = { 0 };
 
-        struct tm filter_tm;
-        if (strptime(filter_time_low, "%Y-%m-%d", &filter_tm))
+        /* bare /query?q= links leave out the form fields */
+        struct tm filter_tm = { 0 };
+        if (filter_time_low &&
+            strptime(filter_time_low, "%Y-%m-%d", &filter_tm))
             filter.time_low = mktime(&filter_tm);
-        else
-            filter.time_low = 0;
 
-        if (strptime(filter_time_high, "%Y-%m-%d", &filter_tm))
+        memset(&filter_tm, 0, sizeof(filter_tm));
+        if (filter_time_high &&
+            strptime(filter_time_high, "%Y-%m-%d", &filter_tm))
             filter.time_high = mktime(&filter_tm);
-        else
-            filter.time_high = 0;
 
-        filter.size_low = atoi(filter_size_low);
-        filter.size_high = atoi(filter_size_high);
+        if (filter_size_low)
+            filter.size_low = atoi(filter_size_low);
+        if (filter_size_high)
+            filter.size_high = atoi(filter_size_high);
 
 
         /* build baseurl with query and filters (no sort) for sort links */
         char baseurl[1024];
-        snprintf(baseurl, 1024, "%s/query?q=%s&t=%s&ftl=%s&fth=%s&fsl=%s&fsh=%s",
+        snprintf(baseurl, 1024,
+            "%s/query?q=%s&t=%s&ftl=%s&fth=%s&fsl=%s&fsh=%s&dir=%s%s%s",
             app_subdir,
-            query,
+            query ? query : "",
             query_type_str,
             filter_time_low ? filter_time_low : "",
             filter_time_high ? filter_time_high : "",
             filter_size_low ? filter_size_low : "",
-            filter_size_high ? filter_size_high : ""
+            filter_size_high ? filter_size_high : "",
+            dir ? dir : "",
+            time_limit_str ? "&tl=" : "",
+            time_limit_str ? time_limit_str : ""
         );
 
 
@@ -276,106 +538,312 @@ enum MHD_Result answer_to_connection(
         struct timespec start, finish;
         clock_gettime(CLOCK_REALTIME, &start);
 
+        /* everything the request allocates, released once it is sent */
+        arena_t *arena = request->arena;
+
         results_t *results = NULL;
-        if (query && g_index)
-            results = index_lookup(g_index, query_type, query);
+        char query_error[256] = "";
+        shard_result_t *shard_stats = arena_alloc(arena,
+            sizeof(shard_result_t) * shards_count());
+
+        /* stops the shards once out of time or when the client hangs up */
+        const union MHD_ConnectionInfo *fdinfo = MHD_get_connection_info(
+            connection, MHD_CONNECTION_INFO_CONNECTION_FD);
+        deadline_t deadline;
+        deadline_init(&deadline, budget, fdinfo ? fdinfo->connect_fd : -1);
+
+        /* fan out to every shard, sorted and filtered per shard, merged */
+        shard_query_t shard_query = {
+            .type = query_type, .query = query, .dir = dir,
+            .filter = &filter, .sort_type = sort_type, .sort_desc = sort_order,
+            .deadline = &deadline
+        };
+        query_t *q = NULL;
+        if (query && query_type == LOOKUP_QUERY) {
+            /* form filters become predicates of the same query */
+            q = query_parse(query, query_error, sizeof(query_error));
+            if (q) {
+                q = query_and_filter(q, &filter);
+                query_plan(q);
+                shard_query.q = q;
+                shard_query.filter = NULL;
+            }
+        }
 
-        clock_gettime(CLOCK_REALTIME, &finish);
+        /* same lookup on the same index generations, nothing to redo */
+        char etag[64] = "";
+        if (query && (query_type != LOOKUP_QUERY || q))
+            shards_etag(&shard_query, etag, sizeof(etag), arena);
+        if (etag_match(connection, etag)) {
+            query_destroy(q);
+            ret = queue_not_modified(connection, etag);
+            accesslog_add(addrstr, method, url, MHD_HTTP_NOT_MODIFIED,
+                request_latency(request), -1, 0, "");
+            return ret;
+        }
 
-        /* sort results */
-        if (results)
-            results_sort(results, sort_type, sort_order);
+        if (query && (query_type != LOOKUP_QUERY || q))
+            results = shards_lookup(&shard_query, shard_stats, arena);
+        query_destroy(q);
 
-        /* filter results */
-        if (results)
-            results = results_filter(results, &filter);
+        clock_gettime(CLOCK_REALTIME, &finish);
+
+        /* nobody to answer, drop the connection */
+        if (atomic_load(&deadline.state) == DEADLINE_CANCELLED) {
+            if (results)
+                results_destroy(results);
+            accesslog_add(addrstr, method, url, 0, request_latency(request),
+                -1, 0, "cancelled");
+            return MHD_NO;
+        }
 
         /* generate response with header, results, and time */
         float lookup_time = (finish.tv_sec + (0.000000001 * finish.tv_nsec)) - 
             (start.tv_sec + (0.000000001 * start.tv_nsec));
 
-        char *results_html = NULL, *resp_buff = NULL;
-        size_t resp_buff_size = 0;
+        const char *checked = "checked=\"checked\"";
+        results_page_t page = {
+            .results = results, .baseurl = baseurl, .sort_type = sort_type,
+            .sort_order = sort_order, .lookup_time = lookup_time,
+            .stats = shard_stats, .nstats = shards_count()
+        };
+
+        /* everything the client sent is reflected escaped */
+        tmpl_value_t values[SLOT_MAX] = { 0 };
+        values[SLOT_QUERY].str = html_escape(query, arena);
+        values[SLOT_TYPE_SUBSTR].str = query_type == LOOKUP_SUBSTR ? checked : "";
+        values[SLOT_TYPE_NOCASE].str =
+            query_type == LOOKUP_SUBSTR_CASEINSENSITIVE ? checked : "";
+        values[SLOT_TYPE_EXACT].str = query_type == LOOKUP_EXACT ? checked : "";
+        values[SLOT_TYPE_REGEX].str = query_type == LOOKUP_REGEX ? checked : "";
+        values[SLOT_TYPE_QUERY].str = query_type == LOOKUP_QUERY ? checked : "";
+        values[SLOT_TIME_LOW].str = html_escape(filter_time_low, arena);
+        values[SLOT_TIME_HIGH].str = html_escape(filter_time_high, arena);
+        values[SLOT_SIZE_LOW].str = html_escape(filter_size_low, arena);
+        values[SLOT_SIZE_HIGH].str = html_escape(filter_size_high, arena);
+        values[SLOT_DIR].str = html_escape(dir, arena);
+
         if (query && results) {
-            results_html = generate_results_html(results);
-            resp_buff_size = strlen(results_html) + 16384;
-            resp_buff = malloc(resp_buff_size);
-            resp_buff_size = snprintf(resp_buff, resp_buff_size,
-                index_format_template,
-                query,
-                query_type == LOOKUP_SUBSTR ? "checked=\"checked\"" : "",
-                query_type == LOOKUP_SUBSTR_CASEINSENSITIVE ? "checked=\"checked\"" : "",
-                query_type == LOOKUP_EXACT ? "checked=\"checked\"" : "",
-                query_type == LOOKUP_REGEX ? "checked=\"checked\"" : "",
-                filter_time_low ? filter_time_low : "",
-                filter_time_high ? filter_time_high : "",
-                filter_size_low ? filter_size_low : "",
-                filter_size_high ? filter_size_high : "",
-                generate_results_header_html(connection, baseurl, sort_type,
-                    sort_order, results->size, lookup_time),
-                results_html);
+            values[SLOT_HEADER].fn = generate_results_header_html;
+            values[SLOT_HEADER].arg = &page;
+            values[SLOT_RESULTS].fn = generate_results_html;
+            values[SLOT_RESULTS].arg = &page;
         }
-        else {
-            resp_buff_size = 16384;
-            resp_buff = malloc(resp_buff_size);
-            resp_buff_size = snprintf(resp_buff, 16384, index_format_template,
-                "checked=\"checked\"", "", "", "", "", "", "", "", "", "",
-                "indexing in progress... try again later");
-        }
-
-        /* send it */
-        response = MHD_create_response_from_buffer(resp_buff_size,
-            (void*)resp_buff, MHD_RESPMEM_PERSISTENT);
+        else
+            values[SLOT_RESULTS].str = *query_error ?
+                html_escape(query_error, arena) :
+                "indexing in progress... try again later";
+
+        /* render, compressing as it goes */
+        int gzip = accepts_gzip(connection);
+        out_t out;
+        out_init(&out, gzip, Z_BEST_SPEED, arena);
+        tmpl_render(index_template, values, &out);
+        out_finish(&out);
+
+        /* send it, the buffer lives until request_completed() */
+        response = MHD_create_response_from_buffer(out.size,
+            (void*)out.buff, MHD_RESPMEM_PERSISTENT);
         
         MHD_add_response_header(response, "Content-Type", "text/html");
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+        if (gzip)
+            MHD_add_response_header(response, "Content-Encoding", "gzip");
+
+        /* complete results stay valid until a shard reindexes */
+        if (*etag && results && !results->partial) {
+            MHD_add_response_header(response, "ETag", etag);
+            MHD_add_response_header(response, "Cache-Control",
+                "public, no-cache");
+        } else
+            MHD_add_response_header(response, "Cache-Control", "no-store");
 
         /* cleanup */
-        if (results)
+        if (results) {
+            nresults = results->size;
             results_destroy(results);
+        }
+
+        bytes = out.size;
+        snprintf(note, sizeof(note), "(%lu allocs, %lu mallocs)",
+            arena->allocs, arena->mallocs);
+        status = MHD_HTTP_OK;
+        ret = MHD_queue_response(connection, status, response);
+        MHD_destroy_response(response);
+    }
+    else if (strcmp(method, "GET") == 0 && is_endpoint(url, "/stats"))
+    {
+        char *resp_buff = malloc(BUFF_SIZE);
+        size_t resp_buff_size = shards_stats(resp_buff, BUFF_SIZE);
+        resp_buff_size += accesslog_stats(resp_buff + resp_buff_size,
+            BUFF_SIZE - resp_buff_size);
+        bytes = resp_buff_size;
+
+        response = MHD_create_response_from_buffer(resp_buff_size,
+            (void*)resp_buff, MHD_RESPMEM_MUST_FREE);
+
+        MHD_add_response_header(response, "Content-Type", "text/plain");
+        MHD_add_response_header(response, "Cache-Control", "no-store");
+
+        status = MHD_HTTP_OK;
+        ret = MHD_queue_response(connection, status, response);
+        MHD_destroy_response(response);
+    }
+    else if (strcmp(method, "POST") == 0 && is_endpoint(url, "/batch")) {
+        arena_t *arena = request->arena;
+        int gzip = accepts_gzip(connection);
+        out_t out;
+        out_init(&out, gzip, Z_BEST_SPEED, arena);
+
+        /* one <type>:<pattern> per line, type s, i or e */
+        out_write(&request->body, "", 1);
+        char *body = request->body.buff, *save = NULL;
+        size_t max = 1;
+        for (const char *c = body; *c; c++)
+            max += *c == '\n';
+
+        lookup_type_t *types = arena_alloc(arena, sizeof(lookup_type_t) * max);
+        const char **patterns = arena_alloc(arena, sizeof(char*) * max);
+        size_t n = 0, pattern_bytes = 0;
+
+        status = MHD_HTTP_OK;
+        if (request->too_large) {
+            status = MHD_HTTP_CONTENT_TOO_LARGE;
+            out_printf(&out, "batch over %d bytes\n", BATCH_MAX_SIZE);
+        }
+
+        for (char *line = strtok_r(body, "\r\n", &save);
+            line && status == MHD_HTTP_OK; line = strtok_r(NULL, "\r\n", &save))
+        {
+            if (strlen(line) < 3 || line[1] != ':' || !strchr("sie", line[0]))
+            {
+                status = MHD_HTTP_BAD_REQUEST;
+                out_printf(&out, "malformed line: %s\n", line);
+                break;
+            }
+
+            /* every pattern costs a hit list and automaton states per byte */
+            pattern_bytes += strlen(line) - 2;
+            if (n == BATCH_MAX_PATTERNS) {
+                status = MHD_HTTP_CONTENT_TOO_LARGE;
+                out_printf(&out, "batch over %d patterns\n",
+                    BATCH_MAX_PATTERNS);
+                break;
+            }
+            if (pattern_bytes > BATCH_MAX_BYTES) {
+                status = MHD_HTTP_CONTENT_TOO_LARGE;
+                out_printf(&out, "batch patterns over %d bytes\n",
+                    BATCH_MAX_BYTES);
+                break;
+            }
+            types[n] = line[0] == 's' ? LOOKUP_SUBSTR : line[0] == 'i' ?
+                LOOKUP_SUBSTR_CASEINSENSITIVE : LOOKUP_EXACT;
+            patterns[n++] = line + 2;
+        }
+
+        results_t **results = NULL;
+        deadline_t deadline;
+        if (status == MHD_HTTP_OK) {
+            const union MHD_ConnectionInfo *fdinfo = MHD_get_connection_info(
+                connection, MHD_CONNECTION_INFO_CONNECTION_FD);
+            deadline_init(&deadline, timeout,
+                fdinfo ? fdinfo->connect_fd : -1);
+
+            batch_t *batch = batch_new(types, patterns, n, arena);
+            results = shards_lookup_batch(batch, n, &deadline, arena);
+            if (!results) {
+                status = MHD_HTTP_SERVICE_UNAVAILABLE;
+                out_puts(&out, "indexing in progress... try again later\n");
+            }
+        }
+
+        if (results && atomic_load(&deadline.state) == DEADLINE_CANCELLED) {
+            for (size_t i = 0; i < n; i++)
+                results_destroy(results[i]);
+            accesslog_add(addrstr, method, url, 0, request_latency(request),
+                -1, 0, "cancelled");
+            return MHD_NO;
+        }
 
-        printf("%d\n", 200);
-        ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+        /* grouped per pattern, in request order */
+        if (results)
+            nresults = 0;
+        for (size_t i = 0; results && i < n; i++) {
+            nresults += results[i]->size;
+            out_printf(&out, "%c:%s\t%ld%s\n", types[i] == LOOKUP_SUBSTR ? 's' :
+                types[i] == LOOKUP_EXACT ? 'e' : 'i', patterns[i],
+                results[i]->size, results[i]->partial ? "\tpartial" : "");
+            for (size_t j = 0; j < results[i]->size; j++)
+                out_printf(&out, "\t%s\n", results[i]->results[j]->path);
+            results_destroy(results[i]);
+        }
+        out_finish(&out);
+
+        response = MHD_create_response_from_buffer(out.size,
+            (void*)out.buff, MHD_RESPMEM_PERSISTENT);
+
+        MHD_add_response_header(response, "Content-Type", "text/plain");
+        MHD_add_response_header(response, "Vary", "Accept-Encoding");
+        if (gzip)
+            MHD_add_response_header(response, "Content-Encoding", "gzip");
+
+        bytes = out.size;
+        snprintf(note, sizeof(note), "(%ld patterns, %lu allocs, %lu mallocs)",
+            n, arena->allocs, arena->mallocs);
+        ret = MHD_queue_response(connection, status, response);
         MHD_destroy_response(response);
-        free(results_html);
-        free(resp_buff);
     }
     else {
         response = MHD_create_response_from_buffer(0, (void*)NULL, 0);
-        printf("%d\n", 418);
-        ret = MHD_queue_response(connection, 418, response);
+        status = 418;
+        ret = MHD_queue_response(connection, status, response);
         MHD_destroy_response(response);
     }
+
+    accesslog_add(addrstr, method, url, status, request_latency(request),
+        nresults, bytes, note);
     return ret;
 }
 
+void request_completed(
+    void *cls, struct MHD_Connection *connection,
+    void **ptr,
+    enum MHD_RequestTerminationCode toe
+) {
+    request_t *request = *ptr;
+    if (request)
+        arena_put(request->arena);
+    *ptr = NULL;
+}
+
 int main() {
     printf("ARFNET search (C) 2025 licence GPLv3\n");
 
     if (config_load(CONFIG_PATH) < 0)
         return 1;
 
-    /* read index template file */
-    FILE *tf = fopen(tmpl_path, "r");
-    if (!tf) {
-        fprintf(stderr, "error opening index template file: %s\n",
-            strerror(errno));
+    /* parse index template file once */
+    index_template = tmpl_load(tmpl_path, slot_names, SLOT_MAX);
+    if (!index_template)
+        return 1;
+
+    render_landing_page();
+
+    /* handlers only queue their log lines */
+    if (accesslog_start() < 0)
         return 1;
-    }
-    fseek(tf, 0, SEEK_END);
-    size_t tfs = ftell(tf);
-    rewind(tf);
-    index_format_template = malloc(tfs + 1);
-    fread(index_format_template, 1, tfs, tf);
-    fclose(tf);
-    index_format_template[tfs] = '\0';
 
     /* start server */
     struct MHD_Daemon *daemon;
 
+    /* a slow query only holds one of the pool threads */
     daemon = MHD_start_daemon(
         MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_EPOLL,
         port, NULL, NULL,
-        &answer_to_connection, NULL, MHD_OPTION_END);
+        &answer_to_connection, NULL,
+        MHD_OPTION_THREAD_POOL_SIZE, (unsigned int)threads,
+        MHD_OPTION_NOTIFY_COMPLETED, &request_completed, NULL,
+        MHD_OPTION_END);
 
     if (!daemon) {
         fprintf(stderr, "error starting libmicrohttpd daemon\n");
@@ -385,28 +853,10 @@ int main() {
     if (index_init() < 0)
         return 1;
 
-    /* index loop */
-    do {
-        time_t time_start = time(NULL);
-        struct tm *tm_now = gmtime(&time_start);
-        static char timestr[256];
-        strftime(timestr, 256, "%Y-%m-%d %H:%M:%S", tm_now);
-
-        printf("[%s] [index] indexeding started...\n", timestr);
-
-        if (g_index)
-            index_destroy(g_index);
-
-        g_index = index_new(INIT_MAP_CAPACITY, root, magic_enable);
-
-        time_t time_stop = time(NULL);
-        tm_now = gmtime(&time_stop);
-        strftime(timestr, 256, "%Y-%m-%d %H:%M:%S", tm_now);
-
-        printf("[%s] [index] indexed finished (%ld s)\n", timestr,
-            time_stop - time_start);
+    /* one crawler per shard, each on its own schedule */
+    if (shards_start() < 0)
+        return 1;
 
-        sleep(period);
-    } while (1);
+    for (;;)
+        pause();
 }
-
@@ -0,0 +1,739 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    query.c: Structured query language and planner
+
+    grammar:
+        expr    := and ( "OR" and )*
+        and     := unary ( [ "AND" ] unary )*
+        unary   := ( "NOT" | "-" ) unary | "(" expr ")" | term
+        term    := field op value | value
+        field   := name | iname | path | ext | mime | size | mtime
+        op      := ":" | "=" | "<" | "<=" | ">" | ">="
+
+*/
+
+#define _GNU_SOURCE
+#include "query.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <stdarg.h>
+
+#define DAY_SECONDS     86400
+
+typedef enum {
+    TOK_END,
+    TOK_LPAREN,
+    TOK_RPAREN,
+    TOK_AND,
+    TOK_OR,
+    TOK_NOT,
+    TOK_WORD
+} token_type_t;
+
+typedef struct {
+    const char *p;
+    token_type_t tok;
+    char *word;         /* current TOK_WORD, unquoted */
+    int quoted_from;    /* offset in word of first quoted char, -1 if none */
+    char *err;
+    size_t errlen;
+    int failed;
+} parser_t;
+
+
+static void
+parse_error(parser_t *ps, const char *msg, const char *arg)
+{
+    if (ps->failed)
+        return;
+    ps->failed = 1;
+    if (ps->err)
+        snprintf(ps->err, ps->errlen, "%s%s%s", msg, arg ? ": " : "",
+            arg ? arg : "");
+}
+
+static void
+next_token(parser_t *ps)
+{
+    while (isspace((unsigned char)*ps->p))
+        ps->p++;
+
+    if (*ps->p == '\0') {
+        ps->tok = TOK_END;
+        return;
+    }
+    if (*ps->p == '(') {
+        ps->p++;
+        ps->tok = TOK_LPAREN;
+        return;
+    }
+    if (*ps->p == ')') {
+        ps->p++;
+        ps->tok = TOK_RPAREN;
+        return;
+    }
+    if (*ps->p == '-' && ps->p[1] && !isspace((unsigned char)ps->p[1]) &&
+        ps->p[1] != ')')
+    {
+        ps->p++;
+        ps->tok = TOK_NOT;
+        return;
+    }
+
+    /* word, quotes may appear anywhere in it */
+    size_t len = 0;
+    ps->quoted_from = -1;
+    while (*ps->p && !isspace((unsigned char)*ps->p) && *ps->p != '(' &&
+        *ps->p != ')')
+    {
+        if (*ps->p == '"') {
+            if (ps->quoted_from < 0)
+                ps->quoted_from = len;
+            for (ps->p++; *ps->p && *ps->p != '"'; ps->p++)
+                ps->word[len++] = *ps->p;
+            if (*ps->p == '"')
+                ps->p++;
+        } else
+            ps->word[len++] = *ps->p++;
+    }
+    ps->word[len] = '\0';
+
+    ps->tok = TOK_WORD;
+    if (ps->quoted_from < 0) {
+        if (strcmp(ps->word, "AND") == 0)
+            ps->tok = TOK_AND;
+        else if (strcmp(ps->word, "OR") == 0)
+            ps->tok = TOK_OR;
+        else if (strcmp(ps->word, "NOT") == 0)
+            ps->tok = TOK_NOT;
+    }
+}
+
+static query_t *
+query_new(query_op_t op)
+{
+    query_t *q = malloc(sizeof(query_t));
+    memset(q, 0, sizeof(query_t));
+    q->op = op;
+    return q;
+}
+
+static query_t *
+query_new_str(query_op_t op, query_cmp_t cmp, const char *str)
+{
+    query_t *q = query_new(op);
+    q->cmp = cmp;
+    q->str = strdup(str);
+    q->len = strlen(str);
+    return q;
+}
+
+static query_t *
+query_new_num(query_op_t op, query_cmp_t cmp, long long num)
+{
+    query_t *q = query_new(op);
+    q->cmp = cmp;
+    q->num = num;
+    return q;
+}
+
+/* append operand, absorbing operands of a nested node of the same kind */
+static void
+query_add(query_t *parent, query_t *child)
+{
+    if (child->op == parent->op && parent->op != QUERY_NOT) {
+        for (size_t i = 0; i < child->nsub; i++)
+            query_add(parent, child->sub[i]);
+        child->nsub = 0;
+        query_destroy(child);
+        return;
+    }
+
+    parent->sub = realloc(parent->sub, sizeof(query_t*) * (parent->nsub + 1));
+    parent->sub[parent->nsub++] = child;
+}
+
+static int
+has_glob(const char *s)
+{
+    return strpbrk(s, "*?[") != NULL;
+}
+
+static int
+parse_size(const char *s, long long *size)
+{
+    char *end;
+    long long n = strtoll(s, &end, 10);
+    if (end == s)
+        return -1;
+
+    switch (toupper((unsigned char)*end)) {
+    case 'K': n *= 1024LL; end++; break;
+    case 'M': n *= 1024LL * 1024LL; end++; break;
+    case 'G': n *= 1024LL * 1024LL * 1024LL; end++; break;
+    case 'T': n *= 1024LL * 1024LL * 1024LL * 1024LL; end++; break;
+    }
+    if (*end == 'i')
+        end++;
+    if (*end == 'B')
+        end++;
+
+    if (*end != '\0')
+        return -1;
+    *size = n;
+    return 0;
+}
+
+static int
+parse_date(const char *s, long long *t)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(struct tm));
+    const char *end = strptime(s, "%Y-%m-%d", &tm);
+    if (!end || *end != '\0')
+        return -1;
+    tm.tm_isdst = -1;
+    *t = mktime(&tm);
+    return 0;
+}
+
+static query_t *
+parse_string_term(parser_t *ps, query_op_t op, char opc, const char *value)
+{
+    if (opc == '<' || opc == '>') {
+        parse_error(ps, "field does not support comparison", value);
+        return NULL;
+    }
+
+    if (op == QUERY_EXT) {
+        if (*value == '.')
+            value++;
+        /* resolved to the interned id, -1 never matches */
+        query_t *q = query_new_str(op, CMP_EQ, value);
+        unsigned int id = index_ext_id(value);
+        q->num = id ? (long long)id : -1;
+        return q;
+    }
+
+    if (opc == '=')
+        return query_new_str(op, CMP_EQ, value);
+
+    if (has_glob(value))
+        return query_new_str(op, CMP_GLOB, value);
+
+    if (op == QUERY_PATH && *value == '/') {
+        /* subtree: paths are stored relative to the root */
+        query_t *q = query_new_str(op, CMP_PREFIX, value + 1);
+        while (q->len > 0 && q->str[q->len - 1] == '/')
+            q->str[--q->len] = '\0';
+        return q;
+    }
+
+    return query_new_str(op, CMP_CONTAINS, value);
+}
+
+static query_t *
+parse_number_term(parser_t *ps, query_op_t op, const char *opstr,
+    const char *value)
+{
+    long long n;
+    if ((op == QUERY_SIZE ? parse_size(value, &n) : parse_date(value, &n)) < 0)
+    {
+        parse_error(ps, op == QUERY_SIZE ? "invalid size" : "invalid date",
+            value);
+        return NULL;
+    }
+
+    query_cmp_t cmp = CMP_EQ;
+    if (opstr[0] == '<')
+        cmp = opstr[1] == '=' ? CMP_LE : CMP_LT;
+    else if (opstr[0] == '>')
+        cmp = opstr[1] == '=' ? CMP_GE : CMP_GT;
+
+    if (op == QUERY_SIZE)
+        return query_new_num(op, cmp, n);
+
+    /* dates name whole days */
+    switch (cmp) {
+    case CMP_LT: return query_new_num(op, CMP_LT, n);
+    case CMP_LE: return query_new_num(op, CMP_LT, n + DAY_SECONDS);
+    case CMP_GT: return query_new_num(op, CMP_GE, n + DAY_SECONDS);
+    case CMP_GE: return query_new_num(op, CMP_GE, n);
+    default: {
+        query_t *q = query_new(QUERY_AND);
+        query_add(q, query_new_num(op, CMP_GE, n));
+        query_add(q, query_new_num(op, CMP_LT, n + DAY_SECONDS));
+        return q;
+    }
+    }
+}
+
+static query_t *
+parse_term(parser_t *ps)
+{
+    char *word = ps->word;
+
+    /* field prefix, unless it is inside quotes */
+    size_t i = 0;
+    while (islower((unsigned char)word[i]))
+        i++;
+
+    if (i == 0 || !strchr(":=<>", word[i]) || word[i] == '\0' ||
+        (ps->quoted_from >= 0 && (size_t)ps->quoted_from <= i))
+    {
+        if (*word == '\0') {
+            parse_error(ps, "empty term", NULL);
+            return NULL;
+        }
+        return query_new_str(QUERY_NAME, has_glob(word) ? CMP_GLOB :
+            CMP_CONTAINS, word);
+    }
+
+    char opstr[3] = { word[i], '\0', '\0' };
+    word[i] = '\0';
+    const char *value = &word[i + 1];
+    if ((opstr[0] == '<' || opstr[0] == '>') && *value == '=') {
+        opstr[1] = '=';
+        value++;
+    }
+
+    if (*value == '\0') {
+        parse_error(ps, "missing value for field", word);
+        return NULL;
+    }
+
+    if (strcmp(word, "name") == 0)
+        return parse_string_term(ps, QUERY_NAME, opstr[0], value);
+    if (strcmp(word, "iname") == 0)
+        return parse_string_term(ps, QUERY_INAME, opstr[0], value);
+    if (strcmp(word, "path") == 0)
+        return parse_string_term(ps, QUERY_PATH, opstr[0], value);
+    if (strcmp(word, "ext") == 0)
+        return parse_string_term(ps, QUERY_EXT, opstr[0], value);
+    if (strcmp(word, "mime") == 0)
+        return parse_string_term(ps, QUERY_MIME, opstr[0], value);
+    if (strcmp(word, "size") == 0)
+        return parse_number_term(ps, QUERY_SIZE, opstr, value);
+    if (strcmp(word, "mtime") == 0)
+        return parse_number_term(ps, QUERY_MTIME, opstr, value);
+
+    parse_error(ps, "unknown field", word);
+    return NULL;
+}
+
+static query_t *parse_or(parser_t *ps);
+
+static query_t *
+parse_unary(parser_t *ps)
+{
+    query_t *q = NULL;
+
+    switch (ps->tok) {
+    case TOK_NOT:
+        next_token(ps);
+        query_t *operand = parse_unary(ps);
+        if (!operand)
+            return NULL;
+        q = query_new(QUERY_NOT);
+        query_add(q, operand);
+        return q;
+    case TOK_LPAREN:
+        next_token(ps);
+        q = parse_or(ps);
+        if (!q)
+            return NULL;
+        if (ps->tok != TOK_RPAREN) {
+            parse_error(ps, "missing )", NULL);
+            query_destroy(q);
+            return NULL;
+        }
+        next_token(ps);
+        return q;
+    case TOK_WORD:
+        q = parse_term(ps);
+        if (q)
+            next_token(ps);
+        return q;
+    case TOK_END:
+        parse_error(ps, "unexpected end of query", NULL);
+        return NULL;
+    default:
+        parse_error(ps, "unexpected operator", NULL);
+        return NULL;
+    }
+}
+
+static query_t *
+parse_and(parser_t *ps)
+{
+    query_t *q = parse_unary(ps);
+    if (!q)
+        return NULL;
+
+    query_t *and = NULL;
+    while (ps->tok == TOK_AND || ps->tok == TOK_NOT || ps->tok == TOK_LPAREN ||
+        ps->tok == TOK_WORD)
+    {
+        if (ps->tok == TOK_AND)
+            next_token(ps);
+
+        query_t *rhs = parse_unary(ps);
+        if (!rhs) {
+            query_destroy(and ? and : q);
+            return NULL;
+        }
+
+        if (!and) {
+            and = query_new(QUERY_AND);
+            query_add(and, q);
+        }
+        query_add(and, rhs);
+    }
+
+    return and ? and : q;
+}
+
+static query_t *
+parse_or(parser_t *ps)
+{
+    query_t *q = parse_and(ps);
+    if (!q)
+        return NULL;
+
+    query_t *or = NULL;
+    while (ps->tok == TOK_OR) {
+        next_token(ps);
+
+        query_t *rhs = parse_and(ps);
+        if (!rhs) {
+            query_destroy(or ? or : q);
+            return NULL;
+        }
+
+        if (!or) {
+            or = query_new(QUERY_OR);
+            query_add(or, q);
+        }
+        query_add(or, rhs);
+    }
+
+    return or ? or : q;
+}
+
+query_t *
+query_parse(const char *s, char *err, size_t errlen)
+{
+    parser_t ps = { 0 };
+    ps.p = s;
+    ps.word = malloc(strlen(s) + 1);
+    ps.err = err;
+    ps.errlen = errlen;
+
+    next_token(&ps);
+    query_t *q = parse_or(&ps);
+    if (q && ps.tok != TOK_END) {
+        parse_error(&ps, ps.tok == TOK_RPAREN ? "unbalanced )" :
+            "trailing input", NULL);
+        query_destroy(q);
+        q = NULL;
+    }
+
+    free(ps.word);
+    return q;
+}
+
+query_t *
+query_and_filter(query_t *query, const filter_t *filter)
+{
+    if (!filter->time_low && !filter->time_high && !filter->size_low &&
+        !filter->size_high)
+        return query;
+
+    query_t *and = query_new(QUERY_AND);
+    if (query)
+        query_add(and, query);
+    if (filter->time_low)
+        query_add(and, query_new_num(QUERY_MTIME, CMP_GE, filter->time_low));
+    if (filter->time_high)
+        query_add(and, query_new_num(QUERY_MTIME, CMP_LE, filter->time_high));
+    if (filter->size_low)
+        query_add(and, query_new_num(QUERY_SIZE, CMP_GE, filter->size_low));
+    if (filter->size_high)
+        query_add(and, query_new_num(QUERY_SIZE, CMP_LE, filter->size_high));
+    return and;
+}
+
+/*
+ * Planner: estimate per-node evaluation cost (arbitrary units, roughly one
+ * per integer compare) and selectivity (fraction of nodes that pass) for
+ * every predicate, then order AND operands so the cheapest most selective
+ * check runs first, and OR operands so the cheapest least selective one does.
+ */
+static float
+plan_rank_and(const query_t *q)
+{
+    return q->cost / (1.0f - q->sel + 1e-6f);
+}
+
+static float
+plan_rank_or(const query_t *q)
+{
+    return q->cost / (q->sel + 1e-6f);
+}
+
+static int
+cmp_plan_and(const void *_q1, const void *_q2)
+{
+    float r1 = plan_rank_and(*(query_t**)_q1),
+        r2 = plan_rank_and(*(query_t**)_q2);
+    return (r1 > r2) - (r1 < r2);
+}
+
+static int
+cmp_plan_or(const void *_q1, const void *_q2)
+{
+    float r1 = plan_rank_or(*(query_t**)_q1),
+        r2 = plan_rank_or(*(query_t**)_q2);
+    return (r1 > r2) - (r1 < r2);
+}
+
+static void
+plan_string(query_t *q, float base)
+{
+    switch (q->cmp) {
+    case CMP_EQ:
+        q->cost = base;
+        q->sel = 0.001f;
+    break;
+    case CMP_PREFIX:
+        q->cost = base;
+        q->sel = 0.1f;
+    break;
+    case CMP_GLOB:
+        q->cost = base * 4.0f;
+        q->sel = 0.1f;
+    break;
+    default:
+        /* longer needles are both costlier and rarer */
+        q->cost = base * 2.0f + q->len * 0.5f;
+        q->sel = 0.5f / (1.0f + q->len * q->len);
+        if (q->sel < 0.001f)
+            q->sel = 0.001f;
+    break;
+    }
+}
+
+void
+query_plan(query_t *q)
+{
+    float pass = 1.0f;
+
+    switch (q->op) {
+    case QUERY_AND:
+        for (size_t i = 0; i < q->nsub; i++)
+            query_plan(q->sub[i]);
+        qsort(q->sub, q->nsub, sizeof(query_t*), cmp_plan_and);
+        q->cost = 0.0f;
+        for (size_t i = 0; i < q->nsub; i++) {
+            q->cost += pass * q->sub[i]->cost;
+            pass *= q->sub[i]->sel;
+        }
+        q->sel = pass;
+    break;
+    case QUERY_OR:
+        for (size_t i = 0; i < q->nsub; i++)
+            query_plan(q->sub[i]);
+        qsort(q->sub, q->nsub, sizeof(query_t*), cmp_plan_or);
+        q->cost = 0.0f;
+        for (size_t i = 0; i < q->nsub; i++) {
+            q->cost += pass * q->sub[i]->cost;
+            pass *= 1.0f - q->sub[i]->sel;
+        }
+        q->sel = 1.0f - pass;
+    break;
+    case QUERY_NOT:
+        query_plan(q->sub[0]);
+        q->cost = q->sub[0]->cost;
+        q->sel = 1.0f - q->sub[0]->sel;
+    break;
+    case QUERY_SIZE:
+    case QUERY_MTIME:
+        q->cost = 1.0f;
+        q->sel = q->cmp == CMP_EQ ? 0.01f : 0.3f;
+    break;
+    case QUERY_EXT:
+        q->cost = 2.0f;
+        q->sel = 0.05f;
+    break;
+    case QUERY_MIME:
+        plan_string(q, 3.0f);
+    break;
+    case QUERY_NAME:
+        plan_string(q, 4.0f);
+    break;
+    case QUERY_INAME:
+        plan_string(q, 8.0f);
+    break;
+    case QUERY_PATH:
+        plan_string(q, q->cmp == CMP_PREFIX ? 4.0f : 16.0f);
+    break;
+    }
+}
+
+static int
+match_string(const query_t *q, const char *s, int nocase)
+{
+    if (!s)
+        return 0;
+
+    switch (q->cmp) {
+    case CMP_EQ:
+        return nocase ? strcasecmp(s, q->str) == 0 : strcmp(s, q->str) == 0;
+    case CMP_GLOB:
+        return fnmatch(q->str, s, nocase ? FNM_CASEFOLD : 0) == 0;
+    case CMP_PREFIX:
+        return strncmp(s, q->str, q->len) == 0 &&
+            (s[q->len] == '\0' || s[q->len] == '/' || q->len == 0);
+    default:
+        return (nocase ? strcasestr(s, q->str) : strstr(s, q->str)) != NULL;
+    }
+}
+
+static int
+match_number(const query_t *q, long long n)
+{
+    switch (q->cmp) {
+    case CMP_LT: return n < q->num;
+    case CMP_LE: return n <= q->num;
+    case CMP_GT: return n > q->num;
+    case CMP_GE: return n >= q->num;
+    default: return n == q->num;
+    }
+}
+
+int
+query_match(const query_t *q, const node_data_t *data)
+{
+    switch (q->op) {
+    case QUERY_AND:
+        for (size_t i = 0; i < q->nsub; i++)
+            if (!query_match(q->sub[i], data))
+                return 0;
+        return 1;
+    case QUERY_OR:
+        for (size_t i = 0; i < q->nsub; i++)
+            if (query_match(q->sub[i], data))
+                return 1;
+        return 0;
+    case QUERY_NOT:
+        return !query_match(q->sub[0], data);
+    case QUERY_NAME:
+        return match_string(q, data->name, 0);
+    case QUERY_INAME:
+        return match_string(q, data->name, 1);
+    case QUERY_PATH:
+        return match_string(q, data->path, 0);
+    case QUERY_EXT:
+        return data->ext_id == q->num;
+    case QUERY_MIME:
+        return match_string(q, data->mime, 0);
+    case QUERY_SIZE:
+        return match_number(q, data->stat.st_size);
+    case QUERY_MTIME:
+        return match_number(q, data->stat.st_mtime);
+    }
+    return 0;
+}
+
+typedef struct {
+    char *buff;
+    size_t size, len;
+} keybuf_t;
+
+static void
+key_printf(keybuf_t *k, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(k->len < k->size ? k->buff + k->len : NULL,
+        k->len < k->size ? k->size - k->len : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        k->len += n;
+}
+
+static void
+query_key_rec(const query_t *q, keybuf_t *k)
+{
+    static const char ops[] = "&|!NIPEMST";
+    static const char cmps[] = "~*^=<{>}";
+
+    switch (q->op) {
+    case QUERY_AND:
+    case QUERY_OR:
+    case QUERY_NOT:
+        key_printf(k, "(%c", ops[q->op]);
+        for (size_t i = 0; i < q->nsub; i++)
+            query_key_rec(q->sub[i], k);
+        key_printf(k, ")");
+    break;
+    case QUERY_EXT:
+    case QUERY_SIZE:
+    case QUERY_MTIME:
+        key_printf(k, "%c%c%lld;", ops[q->op], cmps[q->cmp], q->num);
+    break;
+    default:
+        /* length prefixed, any byte may follow */
+        key_printf(k, "%c%c%zu:%s", ops[q->op], cmps[q->cmp], q->len, q->str);
+    break;
+    }
+}
+
+/*
+ * Canonical form of a planned query, equal for queries that only differ in
+ * spacing, quoting or extension case. Returns the length like snprintf().
+ */
+size_t
+query_key(const query_t *query, char *buff, size_t size)
+{
+    keybuf_t k = { buff, size, 0 };
+    query_key_rec(query, &k);
+    if (size && k.len >= size)
+        buff[size - 1] = '\0';
+    return k.len;
+}
+
+void
+query_destroy(query_t *q)
+{
+    if (!q)
+        return;
+    for (size_t i = 0; i < q->nsub; i++)
+        query_destroy(q->sub[i]);
+    free(q->sub);
+    free(q->str);
+    free(q);
+}
+
@@ -0,0 +1,73 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    query.c: Structured query language and planner
+
+*/
+
+#ifndef _QUERY_H
+#define _QUERY_H
+
+#include <stddef.h>
+
+#include "index.h"
+
+typedef enum {
+    QUERY_AND,
+    QUERY_OR,
+    QUERY_NOT,
+    QUERY_NAME,
+    QUERY_INAME,
+    QUERY_PATH,
+    QUERY_EXT,
+    QUERY_MIME,
+    QUERY_SIZE,
+    QUERY_MTIME
+} query_op_t;
+
+typedef enum {
+    CMP_CONTAINS,
+    CMP_GLOB,
+    CMP_PREFIX,
+    CMP_EQ,
+    CMP_LT,
+    CMP_LE,
+    CMP_GT,
+    CMP_GE
+} query_cmp_t;
+
+typedef struct query_s {
+    query_op_t op;
+    query_cmp_t cmp;
+    char *str;                  /* string operand */
+    size_t len;
+    long long num;              /* numeric operand */
+    struct query_s **sub;       /* AND, OR, NOT operands */
+    size_t nsub;
+    float cost, sel;            /* planner estimates */
+} query_t;
+
+query_t *query_parse(const char *s, char *err, size_t errlen);
+query_t *query_and_filter(query_t *query, const filter_t *filter);
+void query_plan(query_t *query);
+int query_match(const query_t *query, const node_data_t *data);
+size_t query_key(const query_t *query, char *buff, size_t size);
+void query_destroy(query_t *query);
+
+#endif /* _QUERY_H */
+
@@ -0,0 +1,800 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    shard.c: Per root index shards, crawlers and fan-out lookup
+
+*/
+
+#include "shard.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "query.h"
+
+typedef struct {
+    char *root, *name;
+    size_t strip;               /* path prefix removed from node paths */
+    int period;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    index_t index;              /* current, owns a reference */
+    unsigned long generation;
+
+    /* stats */
+    crawl_progress_t progress;  /* of the running crawl */
+    int crawling;
+    time_t crawl_started;
+    size_t nodes;
+    time_t index_finished;
+    long index_duration;
+    unsigned long lookups, partials;
+    double lookup_time;
+} shard_t;
+
+/* a job queued for the lookup pool, lives in the request arena */
+typedef struct work_s {
+    void *(*fn)(void*);
+    void *arg;
+    int done;
+    struct work_s *next;
+} work_t;
+
+typedef struct {
+    work_t work;
+    shard_t *shard;
+    const shard_query_t *query;
+    const char *dir;            /* shard relative */
+    arena_t *arena;
+    results_t *results;
+    shard_result_t *stats;
+} shard_job_t;
+
+typedef struct {
+    work_t work;
+    shard_t *shard;
+    const batch_t *batch;
+    size_t n;
+    arena_t *arena;
+    deadline_t *deadline;
+    results_t **results;
+} batch_job_t;
+
+/* a lookup in progress that identical lookups wait for */
+typedef struct flight_s {
+    char *key;
+    int finished;
+    size_t refs;                /* the leader and its waiters */
+    sort_type_t sort_type;
+    int sort_desc;
+    results_t *results;         /* the leader's, read-only once finished */
+    const shard_result_t *stats;
+    struct flight_s *next;
+} flight_t;
+
+static shard_t *shards = NULL;
+static size_t nshards = 0;
+
+static pthread_mutex_t flights_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flights_done;     /* CLOCK_MONOTONIC, see shards_start() */
+static pthread_cond_t flights_copied = PTHREAD_COND_INITIALIZER;
+static flight_t *flights = NULL;
+static unsigned long flights_scans = 0, flights_coalesced = 0;
+
+/* generations restart with the process, etags carry the start time too */
+static time_t shards_epoch = 0;
+
+/* lookup pool shared by all requests, see work_wait() */
+static pthread_mutex_t work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static work_t *work_head = NULL, **work_tail = &work_head;
+static size_t nworkers = 0;
+
+static void
+timestamp(char *buff, size_t size, time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buff, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void *
+work_loop(void *arg)
+{
+    pthread_mutex_lock(&work_lock);
+    for (;;) {
+        while (!work_head)
+            pthread_cond_wait(&work_ready, &work_lock);
+        work_t *work = work_head;
+        work_head = work->next;
+        if (!work_head)
+            work_tail = &work_head;
+        pthread_mutex_unlock(&work_lock);
+
+        work->fn(work->arg);
+
+        pthread_mutex_lock(&work_lock);
+        work->done = 1;
+        pthread_cond_broadcast(&work_done);
+    }
+    return NULL;
+}
+
+static void
+work_submit(work_t *work, void *(*fn)(void*), void *arg)
+{
+    work->fn = fn;
+    work->arg = arg;
+    work->done = 0;
+    work->next = NULL;
+
+    pthread_mutex_lock(&work_lock);
+    *work_tail = work;
+    work_tail = &work->next;
+    pthread_cond_signal(&work_ready);
+    pthread_mutex_unlock(&work_lock);
+}
+
+/* work no worker has taken yet runs on the caller, so a busy or empty pool
+ * never stalls a request */
+static void
+work_wait(work_t *work)
+{
+    pthread_mutex_lock(&work_lock);
+    for (work_t **link = &work_head; *link; link = &(*link)->next) {
+        if (*link != work)
+            continue;
+        *link = work->next;
+        if (!*link)
+            work_tail = link;
+        pthread_mutex_unlock(&work_lock);
+        work->fn(work->arg);
+        return;
+    }
+    while (!work->done)
+        pthread_cond_wait(&work_done, &work_lock);
+    pthread_mutex_unlock(&work_lock);
+}
+
+static void *
+shard_crawl(void *arg)
+{
+    shard_t *shard = arg;
+    char timestr[256];
+
+    /* stay out of the way of the file server on the same disks */
+    if (crawl_idle)
+        crawl_set_idle();
+
+    crawl_opts_t opts = {
+        .depth = uring_depth, .rate = crawl_rate, .dir_rate = crawl_dir_rate,
+        .max_load = crawl_max_load, .max_util = crawl_max_util,
+        .disk = crawl_disk, .progress = &shard->progress
+    };
+
+    do {
+        time_t time_start = time(NULL);
+        timestamp(timestr, sizeof(timestr), time_start);
+        printf("[%s] [index] [%s] indexing started...\n", timestr,
+            shard->name);
+
+        pthread_mutex_lock(&shard->lock);
+        shard->crawling = 1;
+        shard->crawl_started = time_start;
+        pthread_mutex_unlock(&shard->lock);
+
+        index_t index = index_new(INIT_MAP_CAPACITY, shard->root,
+            shard->strip, magic_enable, &opts);
+
+        pthread_mutex_lock(&shard->lock);
+        shard->crawling = 0;
+        pthread_mutex_unlock(&shard->lock);
+
+        time_t time_stop = time(NULL);
+        timestamp(timestr, sizeof(timestr), time_stop);
+
+        if (index) {
+            pthread_mutex_lock(&shard->lock);
+            index_t old = shard->index;
+            shard->index = index;
+            shard->generation++;
+            shard->nodes = index_size(index);
+            shard->index_finished = time_stop;
+            shard->index_duration = time_stop - time_start;
+            pthread_mutex_unlock(&shard->lock);
+
+            /* freed once the last lookup using it is done */
+            if (old)
+                index_unref(old);
+
+            printf("[%s] [index] [%s] indexed finished (%ld s, %ld nodes)\n",
+                timestr, shard->name, time_stop - time_start,
+                index_size(index));
+        } else
+            fprintf(stderr, "[%s] [index] [%s] indexing failed\n", timestr,
+                shard->name);
+
+        sleep(shard->period);
+    } while (1);
+
+    return NULL;
+}
+
+int
+shards_start(void)
+{
+    shards = malloc(sizeof(shard_t) * nroots);
+    memset(shards, 0, sizeof(shard_t) * nroots);
+    nshards = nroots;
+    shards_epoch = time(NULL);
+
+    /* waiters sleep until their own deadline */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flights_done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    for (size_t i = 0; i < nshards; i++) {
+        shard_t *shard = &shards[i];
+
+        shard->root = strdup(roots[i].path);
+        size_t len = strlen(shard->root);
+        while (len > 1 && shard->root[len - 1] == '/')
+            shard->root[--len] = '\0';
+
+        char *slash = strrchr(shard->root, '/');
+        shard->name = strdup(slash && slash[1] ? slash + 1 : shard->root);
+
+        /* with several roots paths keep the root name to stay unique */
+        shard->strip = nshards > 1 ? len - strlen(shard->name) : len + 1;
+
+        shard->period = roots[i].period;
+        pthread_mutex_init(&shard->lock, NULL);
+
+        for (size_t j = 0; j < i; j++)
+            if (strcmp(shards[j].name, shard->name) == 0)
+                fprintf(stderr, "[shard] W: roots %s and %s share a name\n",
+                    shards[j].root, shard->root);
+    }
+
+    for (size_t i = 0; i < nshards; i++) {
+        if (pthread_create(&shards[i].thread, NULL, shard_crawl,
+            &shards[i]) != 0)
+        {
+            fprintf(stderr, "[shard] error starting crawler for %s\n",
+                shards[i].root);
+            return -1;
+        }
+    }
+
+    /* the requesting thread takes one shard itself */
+    for (size_t i = 0; i < (nshards - 1) * SHARD_WORKERS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, work_loop, NULL) != 0) {
+            fprintf(stderr, "[shard] W: %ld of %ld lookup workers started\n",
+                nworkers, (nshards - 1) * SHARD_WORKERS);
+            break;
+        }
+        pthread_detach(thread);
+        nworkers++;
+    }
+
+    return 0;
+}
+
+size_t
+shards_count(void)
+{
+    return nshards;
+}
+
+/* shard relative dir, NULL if the shard is outside the scope */
+static const char *
+shard_dir(const shard_t *shard, const char *dir)
+{
+    if (!dir || nshards == 1)
+        return dir;
+
+    while (*dir == '/')
+        dir++;
+    if (!*dir)
+        return dir;
+
+    size_t len = strcspn(dir, "/");
+    if (len != strlen(shard->name) || strncmp(dir, shard->name, len) != 0)
+        return NULL;
+    return dir + len;
+}
+
+static void *
+shard_lookup_job(void *arg)
+{
+    shard_job_t *job = arg;
+    shard_t *shard = job->shard;
+    const shard_query_t *query = job->query;
+
+    job->stats->name = shard->name;
+
+    pthread_mutex_lock(&shard->lock);
+    index_t index = shard->index;
+    if (index)
+        index_ref(index);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!index)
+        return NULL;
+    job->stats->ready = 1;
+
+    struct timespec start, finish;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (query->q)
+        job->results = index_lookup_query(index, query->q, job->dir,
+            job->arena, query->deadline);
+    else
+        job->results = index_lookup(index, query->type, query->query,
+            job->dir, query->filter, job->arena, query->deadline);
+    results_sort(job->results, query->sort_type, query->sort_desc);
+
+    clock_gettime(CLOCK_MONOTONIC, &finish);
+
+    /* the results hold their own reference */
+    index_unref(index);
+
+    job->stats->nresults = job->results->size;
+    job->stats->partial = job->results->partial;
+    job->stats->lookup_time = (finish.tv_sec - start.tv_sec) +
+        0.000000001 * (finish.tv_nsec - start.tv_nsec);
+
+    pthread_mutex_lock(&shard->lock);
+    shard->lookups++;
+    shard->partials += job->stats->partial;
+    shard->lookup_time += job->stats->lookup_time;
+    pthread_mutex_unlock(&shard->lock);
+
+    return NULL;
+}
+
+/* results and scratch memory come from the arena, released with it */
+static results_t *
+shards_fan_out(const shard_query_t *query, shard_result_t *stats,
+    arena_t *arena)
+{
+    shard_job_t *jobs = arena_calloc(arena, sizeof(shard_job_t) * nshards);
+
+    memset(stats, 0, sizeof(shard_result_t) * nshards);
+
+    /* fan out, the calling thread takes the first shard */
+    for (size_t i = 0; i < nshards; i++) {
+        jobs[i].shard = &shards[i];
+        jobs[i].query = query;
+        jobs[i].stats = &stats[i];
+        jobs[i].dir = shard_dir(&shards[i], query->dir);
+        stats[i].name = shards[i].name;
+
+        if (!jobs[i].dir && query->dir) {
+            pthread_mutex_lock(&shards[i].lock);
+            stats[i].ready = shards[i].index != NULL;
+            pthread_mutex_unlock(&shards[i].lock);
+            continue;
+        }
+
+        /* arenas are single threaded, other shards borrow their own */
+        jobs[i].arena = i == 0 ? arena : arena_get();
+
+        if (i > 0)
+            work_submit(&jobs[i].work, shard_lookup_job, &jobs[i]);
+    }
+
+    for (size_t i = 0; i < nshards; i++) {
+        if (!jobs[i].dir && query->dir)
+            continue;
+        if (i == 0)
+            shard_lookup_job(&jobs[i]);
+        else
+            work_wait(&jobs[i].work);
+    }
+
+    /* merge the already sorted per shard results */
+    results_t **parts = arena_alloc(arena, sizeof(results_t*) * nshards);
+    size_t nparts = 0;
+    int ready = 0;
+    for (size_t i = 0; i < nshards; i++) {
+        ready |= stats[i].ready;
+        if (jobs[i].results)
+            parts[nparts++] = jobs[i].results;
+    }
+
+    results_t *results = NULL;
+    if (nparts == 1 && parts[0]->arena == arena)
+        results = parts[0];
+    else if (nparts > 0 || ready)
+        results = results_merge(parts, nparts, query->sort_type,
+            query->sort_desc, arena);
+
+    /* the merge copied out of the borrowed arenas */
+    for (size_t i = 1; i < nshards; i++) {
+        if (!jobs[i].arena)
+            continue;
+        arena->allocs += jobs[i].arena->allocs;
+        arena->mallocs += jobs[i].arena->mallocs;
+        arena_put(jobs[i].arena);
+    }
+
+    return results;
+}
+
+/*
+ * Normalized lookup: type, query, filters, scope, time budget and the
+ * generation of every shard, but not the order, which each request applies
+ * to its own copy.
+ */
+static char *
+shards_key(const shard_query_t *query, arena_t *arena)
+{
+    const char *dir = query->dir ? query->dir : "";
+    while (*dir == '/')
+        dir++;
+
+    size_t qlen = query->q ? query_key(query->q, NULL, 0) :
+        strlen(query->query);
+    size_t size = qlen + strlen(dir) + 128 + 24 * nshards;
+    char *key = arena_alloc(arena, size);
+
+    size_t len = snprintf(key, size, "%d|", query->q ? LOOKUP_QUERY :
+        query->type);
+    if (query->q)
+        len += query_key(query->q, key + len, size - len);
+    else
+        len += snprintf(key + len, size - len, "%s", query->query);
+
+    filter_t none = { 0 };
+    const filter_t *filter = query->filter ? query->filter : &none;
+    len += snprintf(key + len, size - len, "|%lld,%lld,%zu,%zu|%s|%ld|",
+        (long long)filter->time_low, (long long)filter->time_high,
+        filter->size_low, filter->size_high, dir,
+        query->deadline ? query->deadline->budget : 0);
+
+    for (size_t i = 0; i < nshards; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        len += snprintf(key + len, size - len, "%lu,",
+            shards[i].index ? shards[i].generation : 0);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    return key;
+}
+
+/*
+ * Weak validator of a result page: the normalized lookup, its order and the
+ * shard generations, so it changes on reindex. Empty until a shard is ready.
+ */
+size_t
+shards_etag(const shard_query_t *query, char *buff, size_t size,
+    arena_t *arena)
+{
+    int ready = 0;
+    for (size_t i = 0; i < nshards; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        ready |= shards[i].index != NULL;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    if (!ready) {
+        *buff = '\0';
+        return 0;
+    }
+
+    /* fnv-1a */
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const char *c = shards_key(query, arena); *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    hash = (hash ^ query->sort_type) * 1099511628211ULL;
+    hash = (hash ^ query->sort_desc) * 1099511628211ULL;
+
+    size_t len = snprintf(buff, size, "W/\"%lx-%016llx\"",
+        (unsigned long)shards_epoch, hash);
+    return len < size ? len : size - 1;
+}
+
+/*
+ * Wait for the leader with flights_lock held, waking up every probe interval
+ * to notice a hangup. Nonzero when this request ran out of time or its client
+ * went away first.
+ */
+static int
+flight_wait(flight_t *flight, deadline_t *deadline)
+{
+    while (!flight->finished) {
+        if (!deadline) {
+            pthread_cond_wait(&flights_done, &flights_lock);
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long until = now.tv_sec * 1000000000LL + now.tv_nsec +
+            DEADLINE_PROBE_MS * 1000000LL;
+        if (deadline->at && deadline->at < until)
+            until = deadline->at;
+
+        struct timespec ts = { until / 1000000000LL, until % 1000000000LL };
+        if (pthread_cond_timedwait(&flights_done, &flights_lock, &ts) ==
+            ETIMEDOUT && !flight->finished && deadline_check(deadline))
+            return -1;
+    }
+    return 0;
+}
+
+/* empty partial results for a waiter that gave up on the leader */
+static results_t *
+shards_gave_up(shard_result_t *stats, arena_t *arena)
+{
+    memset(stats, 0, sizeof(shard_result_t) * nshards);
+    for (size_t i = 0; i < nshards; i++) {
+        stats[i].name = shards[i].name;
+        stats[i].partial = 1;
+        pthread_mutex_lock(&shards[i].lock);
+        stats[i].ready = shards[i].index != NULL;
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    /* a merge of nothing is empty results */
+    results_t *results = results_merge(NULL, 0, SORT_PATH, 0, arena);
+    results->partial = 1;
+    return results;
+}
+
+/*
+ * Single flight: the first of several identical concurrent lookups scans,
+ * the rest wait for it, until their own deadline at most, and copy its
+ * results before sorting them their way. Results the leader got partial,
+ * out of time or because its client went away, are handed over as partial
+ * rather than scanned again by every waiter.
+ */
+results_t *
+shards_lookup(const shard_query_t *query, shard_result_t *stats,
+    arena_t *arena)
+{
+    char *key = shards_key(query, arena);
+
+    pthread_mutex_lock(&flights_lock);
+    flight_t *flight = flights;
+    while (flight && strcmp(flight->key, key) != 0)
+        flight = flight->next;
+
+    if (!flight) {
+        flight = malloc(sizeof(flight_t));
+        memset(flight, 0, sizeof(flight_t));
+        flight->key = strdup(key);
+        flight->refs = 1;
+        flight->next = flights;
+        flights = flight;
+        flights_scans++;
+        pthread_mutex_unlock(&flights_lock);
+
+        results_t *results = shards_fan_out(query, stats, arena);
+        if (results && query->deadline &&
+            atomic_load(&query->deadline->state) == DEADLINE_CANCELLED)
+            results->partial = 1;
+
+        /* done, later lookups scan again; waiters copy out of this
+         * request's arena, so it waits for them before going on */
+        pthread_mutex_lock(&flights_lock);
+        flight_t **link = &flights;
+        while (*link != flight)
+            link = &(*link)->next;
+        *link = flight->next;
+        flight->results = results;
+        flight->stats = stats;
+        flight->sort_type = query->sort_type;
+        flight->sort_desc = query->sort_desc;
+        flight->finished = 1;
+        pthread_cond_broadcast(&flights_done);
+        while (flight->refs > 1)
+            pthread_cond_wait(&flights_copied, &flights_lock);
+        pthread_mutex_unlock(&flights_lock);
+
+        free(flight->key);
+        free(flight);
+        return results;
+    }
+
+    flights_coalesced++;
+    flight->refs++;
+    int gave_up = flight_wait(flight, query->deadline);
+    pthread_mutex_unlock(&flights_lock);
+
+    results_t *results = NULL;
+    int resort = 0;
+    if (gave_up)
+        results = shards_gave_up(stats, arena);
+    else {
+        memcpy(stats, flight->stats, sizeof(shard_result_t) * nshards);
+        if (flight->results)
+            results = results_copy(flight->results, arena);
+        resort = query->sort_type != flight->sort_type ||
+            query->sort_desc != flight->sort_desc;
+    }
+
+    /* the leader may free the flight once the last waiter is out */
+    pthread_mutex_lock(&flights_lock);
+    if (--flight->refs == 1)
+        pthread_cond_signal(&flights_copied);
+    pthread_mutex_unlock(&flights_lock);
+
+    if (results && resort)
+        results_sort(results, query->sort_type, query->sort_desc);
+    return results;
+}
+
+static void *
+shard_batch_job(void *arg)
+{
+    batch_job_t *job = arg;
+    shard_t *shard = job->shard;
+
+    pthread_mutex_lock(&shard->lock);
+    index_t index = shard->index;
+    if (index)
+        index_ref(index);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!index)
+        return NULL;
+
+    job->results = index_lookup_batch(index, job->batch, job->arena,
+        job->deadline);
+    for (size_t i = 0; i < job->n; i++)
+        results_sort(job->results[i], SORT_PATH, 0);
+
+    index_unref(index);
+    return NULL;
+}
+
+/* per pattern results sorted by path, NULL if no shard is ready */
+results_t **
+shards_lookup_batch(const batch_t *batch, size_t n, deadline_t *deadline,
+    arena_t *arena)
+{
+    batch_job_t *jobs = arena_calloc(arena, sizeof(batch_job_t) * nshards);
+
+    for (size_t i = 0; i < nshards; i++) {
+        jobs[i].shard = &shards[i];
+        jobs[i].batch = batch;
+        jobs[i].n = n;
+        jobs[i].deadline = deadline;
+        jobs[i].arena = i == 0 ? arena : arena_get();
+        if (i > 0)
+            work_submit(&jobs[i].work, shard_batch_job, &jobs[i]);
+    }
+
+    shard_batch_job(&jobs[0]);
+    for (size_t i = 1; i < nshards; i++)
+        work_wait(&jobs[i].work);
+
+    results_t **results = NULL;
+    results_t **parts = arena_alloc(arena, sizeof(results_t*) * nshards);
+    size_t nparts = 0;
+    for (size_t i = 0; i < nshards; i++)
+        if (jobs[i].results)
+            nparts++;
+
+    if (nparts == 1 && jobs[0].results)
+        results = jobs[0].results;
+    else if (nparts > 0) {
+        results = arena_alloc(arena, sizeof(results_t*) * n);
+        for (size_t p = 0; p < n; p++) {
+            nparts = 0;
+            for (size_t i = 0; i < nshards; i++)
+                if (jobs[i].results)
+                    parts[nparts++] = jobs[i].results[p];
+            results[p] = results_merge(parts, nparts, SORT_PATH, 0, arena);
+        }
+    }
+
+    for (size_t i = 1; i < nshards; i++) {
+        arena->allocs += jobs[i].arena->allocs;
+        arena->mallocs += jobs[i].arena->mallocs;
+        arena_put(jobs[i].arena);
+    }
+
+    return results;
+}
+
+/* progress of a running crawl, the eta assumes as many nodes as last time */
+static size_t
+shard_crawl_stats(shard_t *shard, char *buff, size_t size)
+{
+    if (!shard->crawling)
+        return snprintf(buff, size, "\tcrawl: idle\n");
+
+    size_t dirs = atomic_load(&shard->progress.dirs);
+    size_t entries = atomic_load(&shard->progress.entries);
+    long long paused_ms = atomic_load(&shard->progress.paused_ms);
+    long elapsed = time(NULL) - shard->crawl_started;
+
+    char eta[64] = "unknown";
+    if (shard->nodes && entries && elapsed > 0) {
+        double rate = (double)entries / elapsed;
+        size_t left = entries < shard->nodes ? shard->nodes - entries : 0;
+        snprintf(eta, sizeof(eta), "%.0f s (%.0f%%)", left / rate,
+            100.0 * (shard->nodes - left) / shard->nodes);
+    }
+
+    return snprintf(buff, size,
+        "\tcrawl: running%s\n"
+        "\tcrawl elapsed: %ld s\n"
+        "\tcrawl paused: %lld s\n"
+        "\tcrawl dirs: %ld\n"
+        "\tcrawl entries: %ld\n"
+        "\tcrawl eta: %s\n",
+        atomic_load(&shard->progress.paused) ? ", paused" : "",
+        elapsed, paused_ms / 1000, dirs, entries, eta);
+}
+
+size_t
+shards_stats(char *buff, size_t size)
+{
+    size_t len = 0;
+    char timestr[256];
+
+    pthread_mutex_lock(&flights_lock);
+    len += snprintf(buff + len, size - len,
+        "lookups\n"
+        "\tscans: %lu\n"
+        "\tcoalesced: %lu\n",
+        flights_scans, flights_coalesced);
+    pthread_mutex_unlock(&flights_lock);
+
+    for (size_t i = 0; i < nshards && len < size; i++) {
+        shard_t *shard = &shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        timestamp(timestr, sizeof(timestr), shard->index_finished);
+        len += snprintf(buff + len, size - len,
+            "shard %s\n"
+            "\troot: %s\n"
+            "\tperiod: %d\n"
+            "\tgeneration: %lu\n"
+            "\tnodes: %ld\n"
+            "\tindexed: %s\n"
+            "\tindex duration: %ld s\n"
+            "\tlookups: %lu\n"
+            "\tpartial lookups: %lu\n"
+            "\tlookup time avg: %f s\n",
+            shard->name, shard->root, shard->period, shard->generation,
+            shard->nodes, shard->index ? timestr : "never",
+            shard->index_duration, shard->lookups, shard->partials,
+            shard->lookups ? shard->lookup_time / shard->lookups : 0.0);
+        if (len < size)
+            len += shard_crawl_stats(shard, buff + len, size - len);
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    return len < size ? len : size - 1;
+}
+
@@ -0,0 +1,59 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    shard.c: Per root index shards, crawlers and fan-out lookup
+
+*/
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <stddef.h>
+
+#include "index.h"
+
+typedef struct {
+    lookup_type_t type;
+    const char *query;          /* plain lookup types */
+    const struct query_s *q;    /* LOOKUP_QUERY, parsed and planned */
+    const char *dir;
+    const filter_t *filter;     /* plain lookup types, NULL for none */
+    sort_type_t sort_type;
+    int sort_desc;
+    deadline_t *deadline;       /* shared by the shards, NULL for none */
+} shard_query_t;
+
+typedef struct {
+    const char *name;
+    int ready, partial;
+    size_t nresults;
+    float lookup_time;
+} shard_result_t;
+
+int shards_start(void);
+size_t shards_count(void);
+results_t *shards_lookup(const shard_query_t *query, shard_result_t *stats,
+    arena_t *arena);
+results_t **shards_lookup_batch(const batch_t *batch, size_t n,
+    deadline_t *deadline, arena_t *arena);
+size_t shards_etag(const shard_query_t *query, char *buff, size_t size,
+    arena_t *arena);
+size_t shards_stats(char *buff, size_t size);
+
+#endif /* _SHARD_H */
+
@@ -0,0 +1,299 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    template.c: Precompiled templates and compressed response output
+
+    Templates are parsed once into literal segments each followed by a named
+    slot, written as {{name}}, and rendered by concatenation.
+
+*/
+
+#include "template.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "config.h"
+
+#define OUT_CHUNK   16384
+
+typedef struct {
+    const char *literal;
+    size_t len;
+    int slot;           /* following the literal, -1 at the end */
+} segment_t;
+
+struct tmpl_s {
+    char *text;
+    segment_t *segments;
+    size_t nsegments;
+};
+
+
+static void
+tmpl_add_segment(tmpl_t *tmpl, const char *literal, size_t len, int slot)
+{
+    tmpl->segments = realloc(tmpl->segments,
+        sizeof(segment_t) * (tmpl->nsegments + 1));
+    tmpl->segments[tmpl->nsegments].literal = literal;
+    tmpl->segments[tmpl->nsegments].len = len;
+    tmpl->segments[tmpl->nsegments].slot = slot;
+    tmpl->nsegments++;
+}
+
+tmpl_t *
+tmpl_load(const char *path, const char **slots, size_t nslots)
+{
+    FILE *tf = fopen(path, "r");
+    if (!tf) {
+        fprintf(stderr, "[template] error opening %s: %s\n", path,
+            strerror(errno));
+        return NULL;
+    }
+
+    tmpl_t *tmpl = malloc(sizeof(tmpl_t));
+    memset(tmpl, 0, sizeof(tmpl_t));
+
+    fseek(tf, 0, SEEK_END);
+    size_t tfs = ftell(tf);
+    rewind(tf);
+    tmpl->text = malloc(tfs + 1);
+    tfs = fread(tmpl->text, 1, tfs, tf);
+    fclose(tf);
+    tmpl->text[tfs] = '\0';
+
+    const char *pos = tmpl->text;
+    for (;;) {
+        const char *open = strstr(pos, "{{");
+        const char *close = open ? strstr(open + 2, "}}") : NULL;
+        if (!close) {
+            tmpl_add_segment(tmpl, pos, strlen(pos), -1);
+            break;
+        }
+
+        const char *name = open + 2;
+        size_t namelen = close - name;
+
+        int slot = -1;
+        for (size_t i = 0; i < nslots; i++)
+            if (strlen(slots[i]) == namelen &&
+                strncmp(slots[i], name, namelen) == 0)
+                slot = i;
+
+        if (slot < 0) {
+            fprintf(stderr, "[template] unknown slot %.*s in %s\n",
+                (int)namelen, name, path);
+            tmpl_destroy(tmpl);
+            return NULL;
+        }
+
+        tmpl_add_segment(tmpl, pos, open - pos, slot);
+        pos = close + 2;
+    }
+
+    return tmpl;
+}
+
+void
+tmpl_render(const tmpl_t *tmpl, const tmpl_value_t *values, out_t *out)
+{
+    for (size_t i = 0; i < tmpl->nsegments; i++) {
+        const segment_t *segment = &tmpl->segments[i];
+        out_write(out, segment->literal, segment->len);
+
+        if (segment->slot < 0)
+            continue;
+
+        const tmpl_value_t *value = &values[segment->slot];
+        if (value->fn)
+            value->fn(out, value->arg);
+        else if (value->str)
+            out_puts(out, value->str);
+    }
+}
+
+void
+tmpl_destroy(tmpl_t *tmpl)
+{
+    free(tmpl->segments);
+    free(tmpl->text);
+    free(tmpl);
+}
+
+static void
+out_reserve(out_t *out, size_t len)
+{
+    if (out->size + len <= out->capacity)
+        return;
+
+    size_t old = out->capacity;
+    while (out->size + len > out->capacity)
+        out->capacity = out->capacity ? out->capacity * 2 : OUT_CHUNK;
+    out->buff = out->arena ?
+        arena_realloc(out->arena, out->buff, old, out->capacity) :
+        realloc(out->buff, out->capacity);
+}
+
+/* deflate state from the arena too, freed with it */
+static voidpf
+out_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    return arena_alloc(opaque, (size_t)items * size);
+}
+
+static void
+out_zfree(voidpf opaque, voidpf ptr)
+{
+}
+
+void
+out_init(out_t *out, int gzip, int level, arena_t *arena)
+{
+    memset(out, 0, sizeof(out_t));
+    out->gzip = gzip;
+    out->arena = arena;
+
+    if (arena) {
+        out->zs.zalloc = out_zalloc;
+        out->zs.zfree = out_zfree;
+        out->zs.opaque = arena;
+    }
+
+    /* 16 + window bits for a gzip wrapper */
+    if (gzip && deflateInit2(&out->zs, level, Z_DEFLATED, 15 + 16, 8,
+        Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        fprintf(stderr, "[template] error deflateInit2()\n");
+        out->gzip = 0;
+    }
+}
+
+static void
+out_deflate(out_t *out, const char *data, size_t len, int flush)
+{
+    out->zs.next_in = (Bytef*)data;
+    out->zs.avail_in = len;
+
+    do {
+        out_reserve(out, OUT_CHUNK);
+        out->zs.next_out = (Bytef*)out->buff + out->size;
+        out->zs.avail_out = out->capacity - out->size;
+        size_t avail = out->zs.avail_out;
+        deflate(&out->zs, flush);
+        out->size += avail - out->zs.avail_out;
+    } while (out->zs.avail_in > 0 || out->zs.avail_out == 0);
+}
+
+void
+out_write(out_t *out, const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    if (out->gzip) {
+        out_deflate(out, data, len, Z_NO_FLUSH);
+        return;
+    }
+
+    out_reserve(out, len);
+    memcpy(out->buff + out->size, data, len);
+    out->size += len;
+}
+
+void
+out_puts(out_t *out, const char *s)
+{
+    out_write(out, s, strlen(s));
+}
+
+void
+out_printf(out_t *out, const char *fmt, ...)
+{
+    char buff[4096];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(buff, sizeof(buff), fmt, ap);
+    va_end(ap);
+
+    if (len < 0)
+        return;
+
+    if ((size_t)len < sizeof(buff)) {
+        out_write(out, buff, len);
+        return;
+    }
+
+    /* does not fit the stack buffer */
+    char *big = out->arena ? arena_alloc(out->arena, len + 1) : malloc(len + 1);
+    va_start(ap, fmt);
+    vsnprintf(big, len + 1, fmt, ap);
+    va_end(ap);
+    out_write(out, big, len);
+    if (!out->arena)
+        free(big);
+}
+
+void
+out_finish(out_t *out)
+{
+    if (!out->gzip)
+        return;
+    out_deflate(out, NULL, 0, Z_FINISH);
+    deflateEnd(&out->zs);
+}
+
+void
+out_free(out_t *out)
+{
+    if (!out->arena)
+        free(out->buff);
+    out->buff = NULL;
+    out->size = out->capacity = 0;
+}
+
+/* s with &, <, >, " and ' as entities, s itself when it has none of them */
+const char *
+html_escape(const char *s, arena_t *arena)
+{
+    if (!s || !s[strcspn(s, "&<>\"'")])
+        return s;
+
+    static const char *entities[256] = {
+        ['&'] = "&amp;", ['<'] = "&lt;", ['>'] = "&gt;", ['"'] = "&quot;",
+        ['\''] = "&#39;"
+    };
+
+    size_t size = 1;
+    for (const unsigned char *c = (const unsigned char*)s; *c; c++)
+        size += entities[*c] ? strlen(entities[*c]) : 1;
+
+    char *escaped = arena_alloc(arena, size), *p = escaped;
+    for (const unsigned char *c = (const unsigned char*)s; *c; c++) {
+        if (entities[*c]) {
+            strcpy(p, entities[*c]);
+            p += strlen(entities[*c]);
+        } else
+            *p++ = *c;
+    }
+    *p = '\0';
+    return escaped;
+}
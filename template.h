@@ -0,0 +1,66 @@
+/*
+
+    arfnet2-search: Fast file indexer and search
+    Copyright (C) 2025 arf20 (Ángel Ruiz Fernandez)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+    template.c: Precompiled templates and compressed response output
+
+*/
+
+#ifndef _TEMPLATE_H
+#define _TEMPLATE_H
+
+#include <stddef.h>
+
+#include <zlib.h>
+
+#include "arena.h"
+
+/* response body, optionally gzip compressed as it is written */
+typedef struct {
+    char *buff;
+    size_t size, capacity;
+    int gzip;
+    z_stream zs;
+    arena_t *arena;     /* backing memory, NULL for the heap */
+} out_t;
+
+typedef void (*tmpl_fn_t)(out_t *out, void *arg);
+
+/* slot value, a string or a generator writing straight to the output */
+typedef struct {
+    const char *str;
+    tmpl_fn_t fn;
+    void *arg;
+} tmpl_value_t;
+
+typedef struct tmpl_s tmpl_t;
+
+tmpl_t *tmpl_load(const char *path, const char **slots, size_t nslots);
+void tmpl_render(const tmpl_t *tmpl, const tmpl_value_t *values, out_t *out);
+void tmpl_destroy(tmpl_t *tmpl);
+
+void out_init(out_t *out, int gzip, int level, arena_t *arena);
+void out_write(out_t *out, const char *data, size_t len);
+void out_puts(out_t *out, const char *s);
+void out_printf(out_t *out, const char *fmt, ...);
+void out_finish(out_t *out);
+void out_free(out_t *out);
+
+const char *html_escape(const char *s, arena_t *arena);
+
+#endif /* _TEMPLATE_H */
+